@@ -0,0 +1,75 @@
+// batch_search.c
+//
+// Looks up random keys falling between the even ints of a sorted array
+// one at a time with array_rvec_bsearch() and array_rvec_lsearch(),
+// then in batches of 1 to 64 keys with array_rvec_bsearch_batch(), and
+// reports the lookup rate of each.
+//
+// gcc -O2 -pthread -I../include batch_search.c ../src/array.c
+//     ../src/pivlib.c ../src/piv_copy.c ../src/piv_alloc.c
+//     ../src/piv_buddy.c ../src/piv_arch.c -o batch_search
+// ./batch_search 100000000
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "array.h"
+
+#define LOOKUPS 1000000
+
+static int int_cmp(const Nint a, const Nint b) {
+    int x = *(const int*)a, y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char** argv) {
+    long count = (argc > 1) ? atol(argv[1]) : 10000000;
+    Nint int_size = -(Nint)sizeof(int);
+    struct array arr = ARRAY_INIT, keys = ARRAY_INIT, results = ARRAY_INIT;
+    for(long i = 0; i < count; i++)
+        *(int*)array_partback(&arr, int_size).nth = 2*i;
+    for(long i = 0; i < LOOKUPS; i++)
+        *(int*)array_partback(&keys, int_size).nth = rand() % count * 2 + 1;
+    array_partback(&results, -(Nint)(LOOKUPS * sizeof(Nint)));
+    struct rvec vec = {arr.nth, arr.zero};
+
+    double t = now();
+    Nint expect = 0;
+    for(Nint key = keys.zero + int_size; key >= keys.nth; key += int_size) {
+        struct rvec window = array_rvec_bsearch((void*)key, vec, int_size,
+                                                int_cmp);
+        expect += array_rvec_lsearch((void*)key, window, int_size, int_cmp);
+    }
+    t = now() - t;
+    printf("one at a time  %7.2f Mlookup/s\n", LOOKUPS / t * 1e-6);
+
+    for(Wint batch = 1; batch <= 64; batch *= 2) {
+        Nint sum = 0;
+        t = now();
+        for(Wint done = 0; done < LOOKUPS; done += batch) {
+            Wint n = (LOOKUPS - done < batch) ? LOOKUPS - done : batch;
+            struct rvec part, out;
+            part.zero = keys.zero + done*int_size;
+            part.nth = part.zero + n*int_size;
+            out.zero = results.zero - done*sizeof(Nint);
+            out.nth = out.zero - n*sizeof(Nint);
+            array_rvec_bsearch_batch(part, int_size, vec, int_size, int_cmp,
+                                     out);
+        }
+        t = now() - t;
+        for(Wint i = 0; i < LOOKUPS; i++)
+            sum += ((Nint*)results.zero)[-1 - (Zint)i];
+        printf("batch of %2lu    %7.2f Mlookup/s%s\n", batch,
+               LOOKUPS / t * 1e-6, (sum == expect) ? "" : "  MISMATCH");
+    }
+    array_free(&arr);
+    array_free(&keys);
+    array_free(&results);
+    return 0;
+}
@@ -0,0 +1,98 @@
+// geomalloc_scaling.c
+//
+// Thread scaling benchmark for the per-thread geomalloc() caches.
+// Every thread churns blocks of a few size classes locally, then frees
+// a batch of blocks that the neighbouring thread allocated, which
+// exercises the remote-free return lists.
+//
+// gcc -O2 -I../include geomalloc_scaling.c ../src/pivlib.c ../src/piv_buddy.c
+//     ../src/piv_arch.c -lpthread -o geomalloc_scaling
+// ./geomalloc_scaling <operations per thread>
+
+#include "pivlib.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define MAX_THREADS 32
+#define BATCH 256
+
+static long ops_per_thread;
+static Nint handoff[MAX_THREADS][BATCH];
+static pthread_barrier_t barrier;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void* worker(void* arg) {
+    (void)arg;
+    Nint live[BATCH];
+    Wchar powers[BATCH];
+    long i;
+    for(i = 0; i < ops_per_thread; i++) {
+        int slot = i % BATCH;
+        if(i >= BATCH)
+            geofree(live[slot], powers[slot]);
+        powers[slot] = 4 + (i % 7);  // 16 B to 1 KiB
+        live[slot] = geomalloc(powers[slot]);
+        *(Wchar*)live[slot] = (Wchar)i;
+    }
+    for(i = 0; i < BATCH; i++)
+        geofree(live[i], powers[i]);
+    return 0;
+}
+
+static int nthreads;
+
+// Frees a batch allocated by the next thread, then drains its own
+static void* remote_worker(void* arg) {
+    long id = (long)arg;
+    long peer = (id + 1) % nthreads;
+    for(int i = 0; i < BATCH; i++)
+        handoff[id][i] = geomalloc(6);
+    pthread_barrier_wait(&barrier);
+    for(int i = 0; i < BATCH; i++)
+        geofree(handoff[peer][i], 6);
+    pthread_barrier_wait(&barrier);
+    for(long i = 0; i < ops_per_thread / BATCH; i++) {
+        Nint b = geomalloc(6);  // drains the remote list first
+        geofree(b, 6);
+    }
+    return 0;
+}
+
+static double run(int n, void* (*f)(void*)) {
+    pthread_t threads[MAX_THREADS];
+    nthreads = n;
+    pthread_barrier_init(&barrier, 0, n);
+    double t = now();
+    for(long i = 0; i < n; i++)
+        pthread_create(&threads[i], 0, f, (void*)i);
+    for(int i = 0; i < n; i++)
+        pthread_join(threads[i], 0);
+    t = now() - t;
+    pthread_barrier_destroy(&barrier);
+    return t;
+}
+
+int main(int argc, char** argv) {
+    if(argc != 2) {
+        printf("Usage: %s <operations per thread>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    ops_per_thread = atol(argv[1]);
+    if(ops_per_thread < BATCH)
+        ops_per_thread = BATCH;
+    printf("threads   local Mops/s   per-thread Mops/s   remote time\n");
+    for(int n = 1; n <= MAX_THREADS; n *= 2) {
+        double t = run(n, worker);
+        double mops = (double)ops_per_thread * n / t / 1e6;
+        double r = run(n, remote_worker);
+        printf("%7d %14.2f %19.2f %12.4fs\n", n, mops, mops / n, r);
+    }
+    return 0;
+}
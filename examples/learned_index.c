@@ -0,0 +1,81 @@
+// learned_index.c
+//
+// Indexes a sorted array of int64_t timestamps with a learned index of
+// a few error bounds and reports the build time, the model size, and
+// the lookup rate against array_rvec_bsearch().
+//
+// gcc -O2 -pthread -I../include learned_index.c ../src/array.c
+//     ../src/pivlib.c ../src/piv_copy.c ../src/piv_alloc.c
+//     ../src/piv_buddy.c ../src/piv_arch.c -o learned_index
+// ./learned_index 100000000
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "array.h"
+
+#define LOOKUPS 1000000
+
+static int int64_cmp(const Nint a, const Nint b) {
+    int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char** argv) {
+    long count = (argc > 1) ? atol(argv[1]) : 10000000;
+    Nint obj_size = -(Nint)sizeof(int64_t);
+    struct array arr = ARRAY_INIT;
+
+    // Event times in microseconds: bursts of close events, idle gaps
+    int64_t t_us = 1700000000000000;
+    for(long i = 0; i < count; i++) {
+        t_us += (rand() % 64) ? 2 * (rand() % 50) : 2 * (rand() % 100000);
+        *(int64_t*)array_partback(&arr, obj_size).nth = t_us;
+    }
+    struct rvec vec = {arr.nth, arr.zero};
+    int64_t first = ((int64_t*)vec.zero)[-1];
+    int64_t* keys = malloc(LOOKUPS * sizeof(int64_t));
+    for(long i = 0; i < LOOKUPS; i++)
+        keys[i] = first + 2 * (((int64_t)rand() << 31 | rand())
+                               % ((t_us - first) / 2)) + 1;
+
+    double t = now();
+    Nint expect = 0;
+    for(long i = 0; i < LOOKUPS; i++) {
+        struct rvec window = array_rvec_bsearch(&keys[i], vec, obj_size,
+                                                int64_cmp);
+        expect += array_rvec_lsearch(&keys[i], window, obj_size, int64_cmp);
+    }
+    t = now() - t;
+    printf("bsearch                           %7.2f Mlookup/s\n",
+           LOOKUPS / t * 1e-6);
+
+    Wint epsilons[] = {16, 64, 256};
+    for(int e = 0; e < 3; e++) {
+        struct array_learned li;
+        t = now();
+        array_rvec_learn(&li, vec, epsilons[e]);
+        double build = now() - t;
+        Nint sum = 0;
+        t = now();
+        for(long i = 0; i < LOOKUPS; i++) {
+            struct rvec window = array_learned_bsearch(keys[i], &li);
+            sum += array_rvec_lsearch_int64_t(keys[i], window);
+        }
+        t = now() - t;
+        printf("learned, epsilon %3lu  %8lu KiB  %7.2f Mlookup/s, "
+               "built in %.3f s%s\n", epsilons[e],
+               (li.segments.zero - li.segments.nth) >> 10,
+               LOOKUPS / t * 1e-6, build, (sum == expect) ? "" : " MISMATCH");
+        array_learned_free(&li);
+    }
+    free(keys);
+    array_free(&arr);
+    return 0;
+}
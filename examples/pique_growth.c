@@ -0,0 +1,67 @@
+// pique_growth.c
+//
+// Pushes ints into a pique and reports the time spent in resizes and
+// the peak resident set size. Build it twice to compare the page
+// moving growth path against the copying one:
+//
+// gcc -O2 -fno-builtin -I../include pique_growth.c ../src/piv_copy.c
+//     ../src/piv_arch.c -o remap
+// gcc -O2 -fno-builtin -I../include -DPIQUE_MREMAP_THRESHOLD='((size_t)-1)'
+//     pique_growth.c ../src/piv_copy.c ../src/piv_arch.c -o copy
+// ./remap 100000000; ./copy 100000000
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "pique.h"
+
+#ifndef PIQUE_INT_XT
+  #define PIQUE_INT_XT
+  PIQUE_DEFINE_XT(int)
+#endif
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char** argv) {
+  if(argc != 2) {
+    printf("Usage: %s <number of ints to push>\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  long count = atol(argv[1]);
+  PIQUE_XT(int) pie1 = PIQUE(int);
+
+  int resizes = 0;
+  double resize_time = 0, worst_resize = 0, total = now();
+  for(long i = 0; i < count; i++) {
+    piv_3state* state = &pie1.slice.state;
+    size_t room = pique_add(state->rend, state->lvec.begin);
+    if(room >= sizeof(int)) {
+      pie1.push(&pie1, (int)i);
+      continue;
+    }
+    double t = now();
+    if(!pie1.push(&pie1, (int)i)) {
+      printf("push %ld failed\n", i);
+      exit(EXIT_FAILURE);
+    }
+    t = now() - t;
+    resizes++;
+    resize_time += t;
+    worst_resize = (t > worst_resize) ? t : worst_resize;
+  }
+  total = now() - total;
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  printf("threshold      %zu bytes\n", (size_t)PIQUE_MREMAP_THRESHOLD);
+  printf("pushes         %ld in %.3f s\n", count, total);
+  printf("resizes        %d taking %.3f s, worst %.3f ms\n",
+         resizes, resize_time, worst_resize * 1e3);
+  printf("peak RSS       %ld KiB\n", usage.ru_maxrss);
+  return 0;
+}
@@ -0,0 +1,110 @@
+// search_specialized.c
+//
+// Times array_rvec_bsearch() plus array_rvec_lsearch() and rvec_cmp()
+// through a compare function pointer against the PIV_DEFINE_SEARCH()
+// versions with the comparison inlined, on int, double and 16 byte
+// struct keys.
+//
+// gcc -O2 -pthread -I../include search_specialized.c ../src/array.c
+//     ../src/pivlib.c ../src/piv_copy.c ../src/piv_alloc.c
+//     ../src/piv_buddy.c ../src/piv_arch.c -o search_specialized
+// ./search_specialized 1000000
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "array.h"
+
+#define LOOKUPS 2000000
+
+typedef double dbl;
+typedef struct { int64_t key; int64_t payload; } rec;
+
+#define VALUE_LESS(x, y) ((x) < (y))
+#define REC_LESS(x, y) ((x).key < (y).key)
+
+PIV_DEFINE_SEARCH(int, VALUE_LESS)
+PIV_DEFINE_SEARCH(dbl, VALUE_LESS)
+PIV_DEFINE_SEARCH(rec, REC_LESS)
+
+static int int_cmp(const Nint a, const Nint b) {
+    int x = *(const int*)a, y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+static int dbl_cmp(const Nint a, const Nint b) {
+    dbl x = *(const dbl*)a, y = *(const dbl*)b;
+    return (x > y) - (x < y);
+}
+
+static int rec_cmp(const Nint a, const Nint b) {
+    int64_t x = ((const rec*)a)->key, y = ((const rec*)b)->key;
+    return (x > y) - (x < y);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Even keys in the array, odd keys looked up
+#define BENCH(type, make)                                                \
+do {                                                                     \
+    struct array arr = ARRAY_INIT, keys = ARRAY_INIT, same = ARRAY_INIT; \
+    Nint obj_size = -(Nint)sizeof(type);                                 \
+    for(long i = 0; i < count; i++)                                      \
+        *(type*)array_partback(&arr, obj_size).nth = make(2*i);          \
+    for(long i = 0; i < LOOKUPS; i++) {                                  \
+        type key = make(rand() % count * 2 + 1);                         \
+        *(type*)array_partback(&keys, obj_size).nth = key;               \
+        *(type*)array_partback(&same, obj_size).nth = key;               \
+    }                                                                    \
+    struct rvec vec = {arr.nth, arr.zero};                               \
+    Nint generic = 0, inlined = 0;                                       \
+    double t = now();                                                    \
+    for(Nint key = keys.nth; key != keys.zero; key -= obj_size) {        \
+        struct rvec window = array_rvec_bsearch((void*)key, vec,         \
+                                                obj_size, type##_cmp);   \
+        generic += array_rvec_lsearch((void*)key, window, obj_size,      \
+                                      type##_cmp);                       \
+    }                                                                    \
+    double t_generic = now() - t;                                        \
+    t = now();                                                           \
+    for(Nint key = keys.nth; key != keys.zero; key -= obj_size) {        \
+        struct rvec window = piv_##type##_bsearch((type*)key, vec);      \
+        inlined += piv_##type##_lsearch((type*)key, window);             \
+    }                                                                    \
+    double t_inlined = now() - t;                                        \
+    struct rvec vec1 = {keys.nth, keys.zero};                            \
+    struct rvec vec2 = {same.nth, same.zero};                            \
+    t = now();                                                           \
+    for(int i = 0; i < 20; i++)                                          \
+        generic += rvec_cmp(vec1, vec2, sizeof(type), type##_cmp);       \
+    double c_generic = now() - t;                                        \
+    t = now();                                                           \
+    for(int i = 0; i < 20; i++)                                          \
+        inlined += piv_##type##_rvec_cmp(vec1, vec2);                    \
+    double c_inlined = now() - t;                                        \
+    printf("%-6s search %6.1f / %6.1f ns, rvec_cmp %6.2f / %6.2f ns "    \
+           "per object%s\n", #type, t_generic / LOOKUPS * 1e9,           \
+           t_inlined / LOOKUPS * 1e9, c_generic / LOOKUPS / 20 * 1e9,    \
+           c_inlined / LOOKUPS / 20 * 1e9,                               \
+           (generic == inlined) ? "" : "  MISMATCH");                    \
+    array_free(&arr);                                                    \
+    array_free(&keys);                                                   \
+    array_free(&same);                                                   \
+} while(0)
+
+#define MAKE_INT(x) ((int)(x))
+#define MAKE_DBL(x) ((dbl)(x))
+#define MAKE_REC(x) ((rec){(x), 0})
+
+int main(int argc, char** argv) {
+    long count = (argc > 1) ? atol(argv[1]) : 1000000;
+    printf("function pointer / inlined\n");
+    BENCH(int, MAKE_INT);
+    BENCH(dbl, MAKE_DBL);
+    BENCH(rec, MAKE_REC);
+    return 0;
+}
@@ -0,0 +1,92 @@
+// sort_comparison.c
+//
+// Sorts the same random ints with qsort(), std::sort(), and the
+// piv_int_introsort() and piv_int_mergesort() that PIV_DEFINE_SORT()
+// generates with the comparison inlined, and reports the time of each.
+// The merge sort runs with 1 and with the given number of threads.
+//
+// g++ -O2 -c sort_comparison_std.cpp
+// gcc -O2 -pthread -I../include sort_comparison.c sort_comparison_std.o
+//     ../src/piv_sort.c ../src/pivlib.c ../src/piv_copy.c
+//     ../src/piv_alloc.c ../src/piv_buddy.c ../src/piv_arch.c -lstdc++
+//     -o sort_comparison
+// ./sort_comparison 10000000 4
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "piv_sort.h"
+
+#define INT_LESS(x, y) ((x) < (y))
+PIV_DEFINE_SORT(int, INT_LESS)
+
+void std_sort_int(int*, size_t);
+
+static int int_cmp(const void* a, const void* b) {
+    int x = *(const int*)a, y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// The rvec sorts ascending from zero, so ints read descending from nth
+static int sorted(const int* a, long count, int descending) {
+    for(long i = 1; i < count; i++)
+        if(descending ? a[i] > a[i-1] : a[i] < a[i-1])
+            return 0;
+    return 1;
+}
+
+static void report(const char* name, double seconds, const int* a,
+                   long count, int descending
+) {
+    printf("%-28s %8.3f s%s\n", name, seconds,
+           sorted(a, count, descending) ? "" : "  NOT SORTED");
+}
+
+int main(int argc, char** argv) {
+    long count = (argc > 1) ? atol(argv[1]) : 10000000;
+    int threads = (argc > 2) ? atoi(argv[2]) : 4;
+    int* input = malloc(count * sizeof(int));
+    int* a = malloc(count * sizeof(int));
+    if(!input || !a) {
+        printf("sort_comparison: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    srand(1);
+    for(long i = 0; i < count; i++)
+        input[i] = rand();
+    struct rvec vec = {(Nint)a, (Nint)(a + count)};
+    char name[64];
+    double start;
+
+    memcpy(vec.zero, (Nint)(input + count), vec.nth - vec.zero);
+    start = now();
+    qsort(a, count, sizeof(int), int_cmp);
+    report("qsort()", now() - start, a, count, 0);
+
+    memcpy(vec.zero, (Nint)(input + count), vec.nth - vec.zero);
+    start = now();
+    std_sort_int(a, count);
+    report("std::sort()", now() - start, a, count, 0);
+
+    memcpy(vec.zero, (Nint)(input + count), vec.nth - vec.zero);
+    start = now();
+    piv_int_introsort(vec);
+    report("piv_int_introsort()", now() - start, a, count, 1);
+
+    for(int t = 1; t <= threads; t = (t < threads) ? threads : t + 1) {
+        memcpy(vec.zero, (Nint)(input + count), vec.nth - vec.zero);
+        start = now();
+        piv_int_mergesort(vec, t);
+        sprintf(name, "piv_int_mergesort(), %d thr", t);
+        report(name, now() - start, a, count, 1);
+    }
+    free(a);
+    free(input);
+    return 0;
+}
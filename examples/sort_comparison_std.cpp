@@ -0,0 +1,10 @@
+// sort_comparison_std.cpp
+//
+// std::sort() for sort_comparison.c, which cannot include <algorithm>.
+
+#include <algorithm>
+#include <stddef.h>
+
+extern "C" void std_sort_int(int* a, size_t n) {
+  std::sort(a, a + n);
+}
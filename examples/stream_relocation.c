@@ -0,0 +1,106 @@
+// stream_relocation.c
+//
+// Relocates an array of the given size (1 GiB by default) while a
+// second thread keeps chasing pointers through a working set that fits
+// in the last level cache, and reports that thread's lookup rate during
+// the relocation with ordinary and with streaming stores.
+//
+// gcc -O2 -pthread -I../include stream_relocation.c ../src/array.c
+//     ../src/pivlib.c ../src/piv_copy.c ../src/piv_alloc.c
+//     ../src/piv_buddy.c ../src/piv_arch.c -o stream_relocation
+// ./stream_relocation 1024
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include "pivlib.h"
+#include "array.h"
+
+static volatile int running;
+static volatile long hops;
+static Wint* chain;
+static Wint chain_len;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void* chase(void* unused) {
+    (void)unused;
+    Wint i = 0;
+    long count = 0;
+    while(running) {
+        for(int k = 0; k < 1024; k++)
+            i = chain[i];
+        count += 1024;
+        hops = count;
+    }
+    return (void*)i;
+}
+
+// Random cyclic permutation of half the last level cache
+static void build_chain(void) {
+    chain_len = noarch_llc_size() / 2 / sizeof(Wint);
+    chain = malloc(chain_len * sizeof(Wint));
+    Wint* order = malloc(chain_len * sizeof(Wint));
+    if(!chain || !order) {
+        printf("build_chain(): malloc() failed\n");
+        exit(EXIT_FAILURE);
+    }
+    for(Wint i = 0; i < chain_len; i++)
+        order[i] = i;
+    for(Wint i = chain_len - 1; i > 0; i--) {
+        Wint j = rand() % (i + 1), t = order[i];
+        order[i] = order[j], order[j] = t;
+    }
+    for(Wint i = 0; i < chain_len; i++)
+        chain[order[i]] = order[(i + 1) % chain_len];
+    free(order);
+}
+
+static void relocate(Wint bytes, Wint threshold, const char* name) {
+    struct array arr = ARRAY_INIT;
+    Nint elem = -(Nint)sizeof(Wint);
+    for(Wint i = 0; i < bytes / sizeof(Wint); i++) {
+        array_partback(&arr, elem);
+        *(Wint*)arr.nth = i;
+    }
+    noarch_stream_threshold(threshold);
+
+    // Time the chaser alone, then while the next push moves the array
+    pthread_t thread;
+    running = 1;
+    hops = 0;
+    pthread_create(&thread, 0, chase, 0);
+    double t = now();
+    while(now() - t < 0.5)
+        ;
+    long idle_hops = hops;
+    double idle = now() - t;
+
+    t = now();
+    long before = hops;
+    array_partback(&arr, elem);
+    long busy_hops = hops - before;
+    double busy = now() - t;
+    running = 0;
+    pthread_join(thread, 0);
+
+    if(name)
+        printf("%-10s relocation %8.3f ms, chaser %6.1f Mhop/s idle, "
+               "%6.1f Mhop/s during\n", name, busy * 1e3,
+               idle_hops / idle * 1e-6, busy_hops / busy * 1e-6);
+    array_free(&arr);
+}
+
+int main(int argc, char** argv) {
+    Wint mib = (argc > 1) ? atol(argv[1]) : 1024;
+    build_chain();
+    relocate(mib << 20, (Wint)-1, 0);   // fault the blocks in once
+    relocate(mib << 20, (Wint)-1, "ordinary");
+    relocate(mib << 20, noarch_llc_size(), "streaming");
+    return 0;
+}
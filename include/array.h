@@ -9,6 +9,8 @@ struct array {
     Nint nth;
     Nint zero;
     Wchar power;
+    Wchar reserve;  // log2 of reserved address space, 0 if heap block
+    const struct piv_allocator* alloc;  // 0 for piv_geomalloc
 };
 
 typedef union {
@@ -16,14 +18,91 @@ typedef union {
     struct rvec rvec;
 } array;
 
-#define ARRAY_INIT {0,0,8*sizeof(Nint)}
+#define ARRAY_INIT {0,0,8*sizeof(Nint),0,0}
+#define BSEARCH_RETURN_SIZE 4   // in # of elements, not byte size
 
+int array_reserve(struct array*, Wchar);  // vector, log2 reserve size
+void array_free(struct array*);
 struct rvec array_partback(struct array*, Nint); // vector, pushback size
 int array_inspart(struct array*, Nint, Nint);
                 // vector, ins_ptr, ins_size
+int array_merge(struct array*, struct rvec, Nint,
+                int (*)(const Nint, const Nint));
+                // sorted vector, sorted batch, obj size, compare f()
+/*
+ *  PIV_DEFINE_SEARCH(type, less) generates piv_<type>_bsearch(),
+ *  piv_<type>_lsearch() and piv_<type>_rvec_cmp(): array_rvec_bsearch(),
+ *  array_rvec_lsearch() and rvec_cmp() for an rvec of type, with the
+ *  comparison inlined. less(x, y) takes two objects by value; type must
+ *  be a single identifier, as for PIQUE_DEFINE_XT().
+ */
+#define PIV_DEFINE_SEARCH(type, less)                                   \
+static inline struct rvec piv_##type##_bsearch(const type* key,         \
+                                               struct rvec vec          \
+) {                                                                     \
+    assert(vec.zero >= vec.nth);                                        \
+    do {                                                                \
+        Wint search_size = (vec.zero - vec.nth) / sizeof(type);         \
+        if(search_size <= BSEARCH_RETURN_SIZE)                          \
+            return vec;                                                 \
+        Nint half_point = vec.zero - (search_size / 2) * sizeof(type);  \
+        const type* half = (const type*)half_point;                     \
+        if(less(*key, *half))                                           \
+            vec.nth = half_point;                                       \
+        else if(less(*half, *key))                                      \
+            vec.zero = half_point;                                      \
+        else {                                                          \
+            vec.zero = half_point + sizeof(type);                       \
+            return vec;                                                 \
+        }                                                               \
+    } while(1);                                                         \
+}                                                                       \
+static inline Nint piv_##type##_lsearch(const type* key,                \
+                                        struct rvec vec                 \
+) {                                                                     \
+    assert(vec.nth <= vec.zero);                                        \
+    while(vec.nth != vec.zero && less(*key, *(const type*)vec.nth))     \
+        vec.nth += sizeof(type);                                        \
+    return vec.nth;                                                     \
+}                                                                       \
+static inline int piv_##type##_rvec_cmp(const struct rvec vec1,         \
+                                        const struct rvec vec2          \
+) {                                                                     \
+    const type* it1 = (const type*)vec1.zero;                           \
+    const type* it2 = (const type*)vec2.zero;                           \
+    Wint len1 = (vec1.zero - vec1.nth) / sizeof(type);                  \
+    Wint len2 = (vec2.zero - vec2.nth) / sizeof(type);                  \
+    Wint len = (len1 < len2) ? len1 : len2;                             \
+    for(Wint i = 1; i <= len; i++) {                                    \
+        if(less(it1[-(Zint)i], it2[-(Zint)i]))                          \
+            return -1;                                                  \
+        if(less(it2[-(Zint)i], it1[-(Zint)i]))                          \
+            return 1;                                                   \
+    }                                                                   \
+    return (len1 > len2) - (len1 < len2);                               \
+}
+
+struct gap_array {
+    struct array array; // elements with the gap among them
+    Nint gap_zero;      // gap, as offsets from array.zero
+    Nint gap_nth;
+};
+
+#define GAP_ARRAY_INIT {ARRAY_INIT,0,0}
+
+struct rvec gap_array_inspart(struct gap_array*, Nint, Nint);
+            // vector, offset from zero ignoring the gap, part size
+            // = the empty part
+struct rvec gap_array_rvec(struct gap_array*);  // closes the gap
+void gap_array_free(struct gap_array*);
 int rvec_cmp(const struct rvec, const struct rvec, size_t,
              int (*)(const Nint, const Nint)
 );
+int rvec_cmp_trivial(const struct rvec, const struct rvec, size_t,
+             int (*)(const Nint, const Nint)
+);  // rvec_cmp() for elements equal when their bytes are, with SIMD;
+    // a null compare f() orders bytes unsigned
+uint64_t rvec_hash(const struct rvec, uint64_t);    // bytes, seed
 struct rvec array_rvec_bsearch(const void *,   //  key obj
                         struct rvec,    // array to search
                         Nint,           // obj size
@@ -34,5 +113,44 @@ Nint array_rvec_lsearch(const void *,   // key obj
                         Nint,           // obj size
                         int (*)(const Nint, const Nint) // compare f()
 );
+Nint array_rvec_lsearch_int8_t(int8_t, struct rvec);  // key, vec
+Nint array_rvec_lsearch_int16_t(int16_t, struct rvec);
+Nint array_rvec_lsearch_int32_t(int32_t, struct rvec);
+Nint array_rvec_lsearch_int64_t(int64_t, struct rvec);
+Nint array_rvec_lsearch_float(float, struct rvec);
+Nint array_rvec_lsearch_double(double, struct rvec);
+void array_rvec_bsearch_batch(struct rvec,    // keys
+                        Nint,           // key size
+                        struct rvec,    // array to search
+                        Nint,           // obj size
+                        int (*)(const Nint, const Nint), // compare f()
+                        struct rvec     // Nint result per key
+);
+
+struct array_frozen {
+    struct rvec eytz;   // nodes in breadth first order
+    struct rvec vec;    // the frozen rvec
+    Nint obj_size;
+    Wchar power;        // eytz block, 8*sizeof(Nint) if none
+};
+
+int array_rvec_freeze(struct array_frozen*, struct rvec, Nint);
+                      // index, sorted rvec, obj size; 0 if out of memory
+void array_frozen_free(struct array_frozen*);
+struct rvec array_frozen_bsearch(const void *,  // key obj
+                        const struct array_frozen*, // index to search
+                        int (*)(const Nint, const Nint) // compare f()
+);
+
+struct array_learned {
+    struct rvec vec;            // the indexed int64_t rvec
+    struct array segments;      // piecewise linear model
+    Wint epsilon;               // position error bound of the model
+};
+
+int array_rvec_learn(struct array_learned*, struct rvec, Wint);
+                     // index, sorted int64_t rvec, epsilon
+void array_learned_free(struct array_learned*);
+struct rvec array_learned_bsearch(int64_t, const struct array_learned*);
 
 #endif
@@ -13,5 +13,6 @@ int pio_fclose(FILE *);
 int pio_printf(const cstr *, ...);
 int pio_fprintf(FILE *, const cstr *, ...);
 int pio_putchar(int);
+int pio_geomalloc_stats(FILE *);
 
 #endif
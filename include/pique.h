@@ -30,13 +30,20 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include <string.h>
 #include <stdio.h>
 #include "piv_stdlib.h"
+#include "piv_arch.h"
+#include "piv_alloc.h"
 
 
 #define PIQUE_RESIZE_FACTOR 3/2
 
+// Buffers of at least this many bytes are page mapped and grow by
+// moving pages (noarch_remap_down()) instead of copying bytes.
+#ifndef PIQUE_MREMAP_THRESHOLD
+#define PIQUE_MREMAP_THRESHOLD ((size_t)1 << 20)
+#endif
+
 #define PIQUE_CONCAT(x, y, z) x ## y ## z
 
 #define PIQUE_DEFINE_XT(type) \
@@ -65,7 +72,7 @@ int PIQUE_CONCAT(pique_, type, _push) ( \
 #define PIQUE_XT(type) struct PIQUE_CONCAT(pique_, type, _pie)
 #define PIQUE(type) \
 { \
-  {0, 0, 0, &pique}, \
+  {{0, {0, 0}, &pique}}, \
   PIQUE_CONCAT(pique_, type, _push) \
 };
 
@@ -81,6 +88,8 @@ piv_piece pique_inc(piv_piece, const size_t);
 void pique_cpy(piv_piece, piv_piece);
 size_t pique_sbrk(piv_3state*, size_t);
 piv_piece pique_remove(piv_3state*, piv_piece);
+piv_piece pique_remap(piv_3state*, size_t);
+size_t pique_sbrk_with(piv_3state*, size_t, const struct piv_allocator*);
 
 piv_table const pique = {
   pique_add,
@@ -104,15 +113,9 @@ piv_piece pique_inc(piv_piece lvec, const size_t rdist) {
 }
 
 void pique_cpy(piv_piece dest, piv_piece src) {
-  // Test for overlap (alias) of source and destination
+  // Streams large disjoint copies, see stream_memcpy()
   size_t data_size = pique_add(src.begin, src.end);
-  piv_piece rvec;
-  rvec.begin = dest.end;
-  rvec.end = pique_add(rvec.begin, data_size);
-  if(rvec.end > src.begin || rvec.begin < src.end)
-    memcpy((char*) rvec.end, (char*) src.end, data_size);
-  else
-    memmove((char*) rvec.end, (char*) src.end, data_size);
+  stream_memcpy(dest.end, src.begin, -(Nint) data_size);
 }
 
 size_t pique_sbrk(piv_3state* state, size_t size) {
@@ -121,14 +124,21 @@ size_t pique_sbrk(piv_3state* state, size_t size) {
   old_size = (pique_add(state->lvec.end, state->rend));
   if(size + old_size > capacity) {
     new_size = ((old_size + size) * PIQUE_RESIZE_FACTOR) & ~(sizeof(int)-1);
-    uintptr_t new = piv_malloc(new_size);
     piv_piece new_alloc, old_piece;
-    old_piece.end = state->rend;
-    old_piece.begin = state->lvec.end;
-    new_alloc.begin = new;
-    new_alloc.end = pique_add(new, (-1) * new_size);
-    pique_cpy(new_alloc, old_piece);
-    piv_free(state->lvec.begin);
+    if(new_size >= PIQUE_MREMAP_THRESHOLD) {
+      new_alloc = pique_remap(state, new_size);
+      if(!new_alloc.begin)
+        return 0;
+    }
+    else {
+      uintptr_t new = piv_malloc(new_size);
+      old_piece.end = state->rend;
+      old_piece.begin = state->lvec.end;
+      new_alloc.begin = new;
+      new_alloc.end = pique_add(new, (-1) * new_size);
+      pique_cpy(new_alloc, old_piece);
+      piv_free(state->lvec.begin);
+    }
     state->lvec = new_alloc;
     state->rend = pique_add(state->lvec.end, (size + old_size));
   }
@@ -138,6 +148,71 @@ size_t pique_sbrk(piv_3state* state, size_t size) {
   return size;
 }
 
+/*
+ * Grows a buffer to at least new_size bytes of whole pages, keeping the
+ * contents right aligned. A buffer is page mapped exactly when its
+ * capacity is at least PIQUE_MREMAP_THRESHOLD, so only the first
+ * crossing of the threshold copies bytes.
+ */
+piv_piece pique_remap(piv_3state* state, size_t new_size) {
+  piv_piece new_alloc = {0, 0};
+  size_t page_mask = (size_t)PIV_PAGE_SIZE - 1;
+  size_t capacity = pique_add(state->lvec.end, state->lvec.begin);
+  size_t old_size = pique_add(state->lvec.end, state->rend);
+  new_size = (new_size + page_mask) & ~page_mask;
+  if(capacity >= PIQUE_MREMAP_THRESHOLD)
+    new_alloc.begin = noarch_remap_down(state->lvec.begin, capacity, new_size);
+  else
+    new_alloc.begin = noarch_map(new_size);
+  if(!new_alloc.begin)
+    return new_alloc;
+  new_alloc.end = pique_add(new_alloc.begin, (-1) * new_size);
+  if(capacity < PIQUE_MREMAP_THRESHOLD) {
+    memcpy(new_alloc.end, state->lvec.end, -(Nint) old_size);
+    piv_free(state->lvec.begin);
+  }
+  return new_alloc;
+}
+
+/*
+ * pique_sbrk() through an allocator handle, e.g. a region's. Buffers
+ * are whole blocks of 2^power bytes and are extended in place whenever
+ * the allocator can, so a pique at the top of a region never copies.
+ * A buffer must be grown through the same allocator all its life.
+ */
+size_t pique_sbrk_with(piv_3state* state, size_t size,
+                       const struct piv_allocator* alloc) {
+  size_t capacity, old_size;
+  capacity = pique_add(state->lvec.end, state->lvec.begin);
+  old_size = pique_add(state->lvec.end, state->rend);
+  if(size + old_size > capacity) {
+    Wchar old_power = 0, new_power = 0;
+    while(((size_t)1 << old_power) < capacity)
+      old_power++;
+    while(((size_t)1 << new_power) < size + old_size)
+      new_power++;
+    if(capacity && alloc->left_grow
+       && alloc->left_grow(alloc->context, state->lvec.end,
+                           old_power, new_power))
+      state->lvec.begin = pique_add(state->lvec.end, (size_t)1 << new_power);
+    else {
+      uintptr_t lend = alloc->left_alloc(alloc->context, new_power);
+      if(!lend)
+        return 0;
+      memcpy(lend, state->lvec.end, -(Nint) old_size);
+      if(capacity)
+        alloc->left_free(alloc->context, state->lvec.end, old_power);
+      state->lvec.end = lend;
+      state->lvec.begin = pique_add(lend, (size_t)1 << new_power);
+    }
+    state->rend = pique_add(state->lvec.end, (size + old_size));
+  }
+  else {
+    state->rend = pique_add(state->rend, size);
+  }
+  return size;
+}
+
 piv_piece pique_remove(piv_3state* state, piv_piece range) {
   piv_piece ret_alloc = {0, 0};
   if(range.end == state->rend && range.begin == state->lvec.end) {
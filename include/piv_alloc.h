@@ -0,0 +1,69 @@
+#ifndef PIV_ALLOC_H
+#define PIV_ALLOC_H
+
+#include "pivlib.h"
+
+/*
+ *  Pluggable allocator handle for left growing blocks of 2^power bytes.
+ *  Blocks are named by their left end (the high address), like the
+ *  blocks of left_geomalloc(). left_grow may be 0; otherwise it tries
+ *  to extend a block toward lower addresses without moving its left
+ *  end and returns nonzero on success.
+ */
+struct piv_allocator {
+    Nint (*left_alloc)(void*, Wchar);               // (context, power)
+    void (*left_free)(void*, Nint, Wchar);          // (context, lend, power)
+    int (*left_grow)(void*, Nint, Wchar, Wchar);    // (.., old, new power)
+    void* context;
+};
+
+extern const struct piv_allocator piv_geomalloc;
+
+/*
+ *  Region allocator.
+ *
+ *  Blocks are bumped off the top of geomalloc()'ed chunks toward lower
+ *  addresses, and the whole region is released at once by
+ *  region_free(). Freeing or growing the most recent block of the
+ *  current chunk only moves the bump pointer, so an array at the
+ *  region top grows in place.
+ */
+#define PIV_REGION_CHUNK_POWER 16   // 64 KiB
+
+struct piv_region {
+    Nint bump;      // right end of the last block handed out
+    Nint floor;     // right end of the usable part of the chunk
+    Nint chunks;    // newest chunk, chunks linked by their header
+};
+
+#define REGION_INIT {0,0,0}
+
+struct piv_allocator region_allocator(struct piv_region*);
+Nint region_left_alloc(void*, Wchar);
+void region_left_free(void*, Nint, Wchar);
+int region_left_grow(void*, Nint, Wchar, Wchar);
+void region_free(struct piv_region*);
+
+/*
+ *  Buddy allocator backing geomalloc() blocks of
+ *  2^PIV_BUDDY_MIN_POWER to 2^PIV_BUDDY_ARENA_POWER bytes. Blocks are
+ *  named by their right end, like geomalloc()'s, and buddy_free()
+ *  coalesces them. buddy_stats() reports the free space; external
+ *  fragmentation is 1 - largest_free / free_bytes.
+ */
+#define PIV_BUDDY_MIN_POWER 20      // the geomalloc() segment size
+#define PIV_BUDDY_ARENA_POWER 30    // 1 GiB arenas
+
+struct piv_buddy_stats {
+    Wint arena_bytes;       // address space mapped for arenas
+    Wint free_bytes;
+    Wint largest_free;
+    Wint free_blocks[8*sizeof(Nint)];   // free block count per power
+};
+
+Nint buddy_alloc(Wchar);
+void buddy_free(Nint, Wchar);
+int buddy_owns(Nint);
+void buddy_stats(struct piv_buddy_stats*);
+
+#endif
@@ -6,6 +6,12 @@
 #include <assert.h>     // assert()
 
 #define PIV_PAGE_SIZE (getpagesize())
+#define PIV_HUGE_PAGE_SIZE (noarch_huge_page_size())
+
+// Huge page modes for noarch_map_huge()
+#define NOARCH_HUGE_NONE 0      // ordinary pages
+#define NOARCH_HUGE_ADVISE 1    // transparent huge pages, madvise()
+#define NOARCH_HUGE_POOL 2      // hugetlb pool, else as ADVISE
 
 
 // #include "pstdint.h"
@@ -14,6 +20,31 @@
 
 
 
+// CPU features for run time kernel dispatch
+#define NOARCH_CPU_SSE2 1
+#define NOARCH_CPU_SSSE3 2
+#define NOARCH_CPU_AVX2 4
+#define NOARCH_CPU_AVX512 8     // AVX-512 F and BW
+#define NOARCH_CPU_SSE42 16
+
 uintptr_t noarch_sbrk(int);
+int noarch_cpu_features(void);
+int noarch_cpu_mask(int);   // features to report = previous mask, -1 at
+                            // first; dispatchers read them only once
+uintptr_t noarch_llc_size(void);    // last level cache bytes
+void noarch_stream_copy(uintptr_t, uintptr_t, uintptr_t);
+          // (dest, src, bytes) low ends; non-temporal stores, no overlap
+uintptr_t noarch_stream_threshold(uintptr_t);
+          // bytes, 0 to keep; = previous, the LLC size at first
+uintptr_t noarch_reserve(uintptr_t);            // bytes; 0 on failure
+int noarch_commit(uintptr_t, uintptr_t);        // (addr, bytes); 0 = ok
+void noarch_release(uintptr_t, uintptr_t);      // (addr, bytes)
+uintptr_t noarch_map(uintptr_t);                // bytes; 0 on failure
+uintptr_t noarch_map_aligned(uintptr_t, uintptr_t);  // (bytes, align)
+uintptr_t noarch_remap_down(uintptr_t, uintptr_t, uintptr_t);
+          // (addr, old bytes, new bytes) = new addr with the old
+          // pages moved to its top; 0 on failure, old map untouched
+uintptr_t noarch_huge_page_size(void);          // PIV_PAGE_SIZE if none
+uintptr_t noarch_map_huge(uintptr_t, int);      // (bytes, mode)
 
 #endif
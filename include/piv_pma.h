@@ -0,0 +1,38 @@
+#ifndef PIV_PMA_H
+#define PIV_PMA_H
+
+#include "pivlib.h"
+#include "array.h"
+
+/*
+ *  Packed memory array.
+ *
+ *  A sorted set of fixed size objects in a block of 2^power slots cut
+ *  into segments of seg_slots slots. Each segment holds its objects
+ *  packed at its zero end, so pma_segment() is an ordinary rvec and a
+ *  range scan walks segments from pma_segment_of() with the rvec
+ *  searches. An insert into a full segment spreads the smallest
+ *  enclosing window of segments that is under its density threshold,
+ *  falling from 1 for a segment to 3/4 for the whole block, and doubles
+ *  the block past that, for O(log^2 n) amortized moves per insert.
+ */
+struct pma {
+    Nint zero;          // left end of the slot block
+    Wchar power;        // 8*sizeof(Nint) if no block
+    Nint obj_size;
+    Wint count;         // objects in the set
+    Wint seg_slots;
+    struct array seg_counts;    // Wint per segment
+    int (*cmp)(const Nint, const Nint);
+};
+
+#define PMA_INIT(obj_size, cmp) {0,8*sizeof(Nint),obj_size,0,0,ARRAY_INIT,cmp}
+
+Nint pma_insert(struct pma*, const void*);  // = the object's new place
+Wint pma_segment_of(const struct pma*, const void*);
+                // segment that holds or would hold the key
+struct rvec pma_segment(const struct pma*, Wint);
+Wint pma_segment_count(const struct pma*);
+void pma_free(struct pma*);
+
+#endif
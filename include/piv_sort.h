@@ -0,0 +1,195 @@
+#ifndef PIV_SORT_H
+#define PIV_SORT_H
+
+#include "pivlib.h"
+
+// Key kinds for rvec_radixsort()
+#define RVEC_RADIX_UINT 0
+#define RVEC_RADIX_INT 1
+#define RVEC_RADIX_FLOAT 2      // IEEE 754 float or double
+
+void rvec_radixsort(struct rvec, Nint, Wint, Wchar, Wchar);
+     // vector, obj size, key offset in obj, key size (1, 2, 4 or 8),
+     // key kind; stable, ascending from zero
+
+/*
+ *  PIV_DEFINE_SORT(type, less) generates, with the comparison inlined:
+ *
+ *  piv_<type>_introsort(vec)          unstable, in place
+ *  piv_<type>_mergesort(vec, threads) stable, parallel
+ *
+ *  Both sort an rvec of type ascending from zero. less(x, y) takes two
+ *  objects by value and type must be a single identifier, as for
+ *  PIQUE_DEFINE_XT(). The generated code works on the objects as a C
+ *  array from nth, where ascending from zero is descending, so it
+ *  orders by before(x, y) = less(y, x).
+ *
+ *  The introsort partitions around a median of three, falls back to
+ *  heapsort past 2 log2(n) levels, and finishes partitions of up to
+ *  PIV_SORT_NETWORK_MAX objects with Batcher's merge exchange network,
+ *  whose compare-exchanges are branch free selects. The merge sort
+ *  hands piv_parallel_sort() a kernel: a stable sequential sort for
+ *  leaves (insertion sorted runs, then bottom up merges), a stable
+ *  merge, and the merge path split of two sorted runs.
+ */
+#define PIV_SORT_NETWORK_MAX 16
+#define PIV_SORT_RUN 16
+
+struct piv_sort_kernel {
+    Wint size;
+    void (*sort)(void*, Wint, void*);   // (objects, count, scratch)
+    void (*merge)(const void*, Wint, const void*, Wint, void*);
+    Wint (*split)(const void*, Wint, const void*, Wint, Wint);
+                    // (a, na, b, nb, diagonal) = objects taken from a
+};
+
+void piv_parallel_sort(struct rvec, const struct piv_sort_kernel*, int);
+     // vector, kernel, threads
+
+#define PIV_DEFINE_SORT(type, less)                                      \
+static inline int piv_##type##_before(const type* x, const type* y) {   \
+    return less(*y, *x);                                                \
+}                                                                       \
+static inline void piv_##type##_cswap(type* a, Wint i, Wint j) {        \
+    type x = a[i], y = a[j];                                            \
+    int swap = piv_##type##_before(&y, &x);                             \
+    a[i] = swap ? y : x;                                                \
+    a[j] = swap ? x : y;                                                \
+}                                                                       \
+static inline void piv_##type##_network(type* a, Wint n) {              \
+    for(Wint p = 1; p < n; p <<= 1)                                     \
+        for(Wint k = p; k >= 1; k >>= 1)                                \
+            for(Wint j = k & (p - 1); j + k < n; j += 2*k)              \
+                for(Wint i = 0; i < k && i + j + k < n; i++)            \
+                    if(!(((i + j) ^ (i + j + k)) & -2*p))               \
+                        piv_##type##_cswap(a, i + j, i + j + k);        \
+}                                                                       \
+static inline void piv_##type##_sift(type* a, Wint root, Wint n) {      \
+    type x = a[root];                                                   \
+    for(Wint child; (child = 2*root + 1) < n; root = child) {           \
+        if(child + 1 < n                                                \
+           && piv_##type##_before(&a[child], &a[child + 1]))            \
+            child++;                                                    \
+        if(!piv_##type##_before(&x, &a[child]))                         \
+            break;                                                      \
+        a[root] = a[child];                                             \
+    }                                                                   \
+    a[root] = x;                                                        \
+}                                                                       \
+static inline void piv_##type##_heapsort(type* a, Wint n) {             \
+    for(Wint i = n / 2; i-- > 0; )                                      \
+        piv_##type##_sift(a, i, n);                                     \
+    while(n > 1) {                                                      \
+        type x = a[0];                                                  \
+        a[0] = a[--n];                                                  \
+        a[n] = x;                                                       \
+        piv_##type##_sift(a, 0, n);                                     \
+    }                                                                   \
+}                                                                       \
+static inline void piv_##type##_introsort_loop(type* a, Wint n,         \
+                                               int depth                \
+) {                                                                     \
+    while(n > PIV_SORT_NETWORK_MAX) {                                   \
+        if(!depth--) {                                                  \
+            piv_##type##_heapsort(a, n);                                \
+            return;                                                     \
+        }                                                               \
+        piv_##type##_cswap(a, n/2, 0);                                  \
+        piv_##type##_cswap(a, 0, n - 1);                                \
+        piv_##type##_cswap(a, n/2, 0);                                  \
+        type pivot = a[0];                                              \
+        Zint i = -1, j = n;                                             \
+        while(1) {                                                      \
+            do i++; while(piv_##type##_before(&a[i], &pivot));          \
+            do j--; while(piv_##type##_before(&pivot, &a[j]));          \
+            if(i >= j)                                                  \
+                break;                                                  \
+            type x = a[i];                                              \
+            a[i] = a[j];                                                \
+            a[j] = x;                                                   \
+        }                                                               \
+        Wint left = j + 1;                                              \
+        if(left < n - left) {                                           \
+            piv_##type##_introsort_loop(a, left, depth);                \
+            a += left, n -= left;                                       \
+        } else {                                                        \
+            piv_##type##_introsort_loop(a + left, n - left, depth);     \
+            n = left;                                                   \
+        }                                                               \
+    }                                                                   \
+    piv_##type##_network(a, n);                                         \
+}                                                                       \
+static inline void piv_##type##_introsort(struct rvec vec) {            \
+    Wint n = (vec.zero - vec.nth) / sizeof(type);                       \
+    if(n > 1)                                                           \
+        piv_##type##_introsort_loop((type*)vec.nth, n,                  \
+                                    2 * log2floor(n));                  \
+}                                                                       \
+static inline void piv_##type##_merge(const void* va, Wint na,          \
+                                      const void* vb, Wint nb,          \
+                                      void* vout                        \
+) {                                                                     \
+    const type *a = (const type*)va, *b = (const type*)vb;              \
+    type* out = (type*)vout;                                            \
+    Wint i = 0, j = 0;                                                  \
+    while(i < na && j < nb)                                             \
+        *out++ = piv_##type##_before(&b[j], &a[i]) ? b[j++] : a[i++];   \
+    while(i < na)                                                       \
+        *out++ = a[i++];                                                \
+    while(j < nb)                                                       \
+        *out++ = b[j++];                                                \
+}                                                                       \
+static inline Wint piv_##type##_split(const void* va, Wint na,          \
+                                      const void* vb, Wint nb,          \
+                                      Wint diag                         \
+) {                                                                     \
+    const type *a = (const type*)va, *b = (const type*)vb;              \
+    Wint lo = (diag > nb) ? diag - nb : 0;                              \
+    Wint hi = (diag < na) ? diag : na;                                  \
+    while(lo < hi) {                                                    \
+        Wint mid = lo + (hi - lo) / 2;                                  \
+        if(piv_##type##_before(&b[diag - mid - 1], &a[mid]))            \
+            hi = mid;                                                   \
+        else                                                            \
+            lo = mid + 1;                                               \
+    }                                                                   \
+    return lo;                                                          \
+}                                                                       \
+static inline void piv_##type##_stable(void* va, Wint n, void* vt) {    \
+    type *a = (type*)va, *t = (type*)vt;                                \
+    for(Wint run = 0; run < n; run += PIV_SORT_RUN) {                   \
+        Wint end = (run + PIV_SORT_RUN < n) ? run + PIV_SORT_RUN : n;   \
+        for(Wint i = run + 1; i < end; i++) {                           \
+            type x = a[i];                                              \
+            Wint j = i;                                                 \
+            for(; j > run && piv_##type##_before(&x, &a[j - 1]); j--)   \
+                a[j] = a[j - 1];                                        \
+            a[j] = x;                                                   \
+        }                                                               \
+    }                                                                   \
+    type *src = a, *dest = t;                                           \
+    for(Wint width = PIV_SORT_RUN; width < n; width *= 2) {             \
+        for(Wint lo = 0; lo < n; lo += 2*width) {                       \
+            Wint mid = (lo + width < n) ? lo + width : n;               \
+            Wint hi = (lo + 2*width < n) ? lo + 2*width : n;            \
+            piv_##type##_merge(src + lo, mid - lo, src + mid, hi - mid, \
+                               dest + lo);                              \
+        }                                                               \
+        type* swap = src;                                               \
+        src = dest, dest = swap;                                        \
+    }                                                                   \
+    if(src != a)                                                        \
+        for(Wint i = 0; i < n; i++)                                     \
+            a[i] = src[i];                                              \
+}                                                                       \
+static const struct piv_sort_kernel piv_##type##_sort_kernel = {        \
+    sizeof(type),                                                       \
+    piv_##type##_stable,                                                \
+    piv_##type##_merge,                                                 \
+    piv_##type##_split                                                  \
+};                                                                      \
+static inline void piv_##type##_mergesort(struct rvec vec, int threads) {\
+    piv_parallel_sort(vec, &piv_##type##_sort_kernel, threads);         \
+}
+
+#endif
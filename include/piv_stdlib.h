@@ -0,0 +1,60 @@
+#ifndef PIV_STDLIB_H
+#define PIV_STDLIB_H
+
+/*
+ * Piece, state and v-table types shared by the piv containers (pique.h)
+ * and the PIV_* accessor macros of pivlib.h.
+ *
+ * A piece is a pair of addresses. For an lvec, .end is the high (left)
+ * end and .begin the low end; for an rvec, .begin is the high end and
+ * .end the low end, so a container's rend aliases its rvec's .end and,
+ * through the union of PIV_SLICE_XT(), its element pointer.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "pivlib.h"
+
+typedef struct {
+  uintptr_t end;
+  uintptr_t begin;
+} piv_piece;
+
+typedef struct {
+  piv_piece lvec;
+} piv_2state;
+
+typedef struct {
+  uintptr_t rend;
+  piv_piece lvec;
+} piv_3state;
+
+typedef struct piv_table {
+  uintptr_t (*const add) (uintptr_t, uintptr_t);
+  piv_piece (*const inc) (piv_piece, const size_t);
+  void (*const cpy) (piv_piece, piv_piece); // (left vec dest, rvec src)
+  size_t (*const sbrk) (piv_3state*, size_t);
+  piv_piece (*const remove) (piv_3state*, piv_piece);
+} piv_table;
+
+struct piv_vec {
+  piv_piece lvec;
+  const piv_table* v_table;
+};
+
+struct piv_slice {
+  uintptr_t rend;
+  piv_piece lvec;
+  const piv_table* v_table;
+};
+
+static inline uintptr_t piv_malloc(size_t size) {
+  void* new = malloc(size);
+  return (new == NULL) ? 0 : (uintptr_t) new;
+}
+
+static inline void piv_free(uintptr_t ptr) {
+  free((void*) ptr);
+}
+
+#endif
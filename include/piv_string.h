@@ -10,6 +10,23 @@
 #define STRING_USTR_LEN_OFFSET 8
 #define STRING_PTR_MASK (((Wint)1 << STRING_PTR_SIZE*8) - 1)
 
+/*
+ *  Define STRING_USTR_PREFIX (for every file) for the prefix layout.
+ *  A heap string then keeps a 32 bit length instead of its rend, and
+ *  its first STRING_USTR_PREFIX_SIZE characters inline in the same
+ *  bytes an inline string keeps them, the last header bytes with
+ *  character 0 highest. Unused inline bytes are 0. ustr_cmp(), ustr_eq()
+ *  and rvec_ustrsort() then settle most pairs from the headers alone.
+ */
+#define STRING_USTR_PREFIX_SIZE 4
+
+/*
+ *  Define STRING_USTR_HASH (for every file) to cache the rvec_hash() of
+ *  heap strings. The header has no room for it, so c2ustr() keeps it in
+ *  the lowest 8 bytes of the string's block, below the characters, and
+ *  ustr_hash() reads it back instead of rehashing.
+ */
+
 #define STRING_MAIN_ASSERT()                                         \
 do {                                                                 \
     int bits;                                                        \
@@ -36,17 +53,55 @@ typedef struct ustr_farlen {
     Nint rend;
 } ustr_rend_offset;
 
+typedef struct ustr_prefix {
+    Wchar padding[STRING_USTR_LEN_OFFSET];
+    uint32_t len;       // of a heap string
+    Wchar chars[STRING_USTR_PREFIX_SIZE];   // reversed, as inline
+} ustr_prefix;
+
 typedef union ustr {
     Wchar* str;
     ustruct ustr;
     char bytes[STRING_USTR_HDR_SIZE];
     ustr_rend_offset rend_offset;
+    ustr_prefix prefix;
 } ustr;
 
 ustr c2ustr(const char *);
+ustr c2ustr_with(const char *, const struct piv_allocator *);
 Wchar* ustr_get_str(const ustr *);
 rvec ustr_get_rvec(const ustr *);
+int ustr_cmp(const ustr *, const ustr *);  // bytes unsigned, as strcmp()
+int ustr_eq(const ustr *, const ustr *);
+uint64_t ustr_hash(const ustr *);   // = rvec_hash(ustr_get_rvec(), 0)
+uint32_t ustr_prefix_key(const ustr *);
+         // first STRING_USTR_PREFIX_SIZE characters, ordered as ustr_cmp()
+         // and 0 padded; inline strings only without STRING_USTR_PREFIX
 void ustr_free(ustr);
+void ustr_free_with(ustr, const struct piv_allocator *);
 void strclear(ustr *);
+void rvec_ustrsort(struct rvec);    // rvec of ustr, ascending from zero
+
+/*
+ *  Intern pool.
+ *
+ *  ustr_intern() hashes a string's bytes once and returns the pool's
+ *  canonical ustr for them, adding a copy on first sight. Canonical
+ *  ustrs are always heap strings, short ones included, so two interned
+ *  ustrs are equal exactly when their USTR_INTERN_ID()s are, and the
+ *  id serves as their hash. They live until ustr_pool_free() and must
+ *  not be ustr_free()'d. Lookups take no lock; the pool is cut into
+ *  USTR_POOL_SHARDS shards by hash, each inserting under its own mutex.
+ */
+#define USTR_POOL_SHARDS 64
+#define USTR_INTERN_ID(s) ((Wint)(s).str & STRING_PTR_MASK)
+
+struct ustr_pool;
+
+struct ustr_pool* ustr_pool_new(void);
+ustr ustr_intern(struct ustr_pool *, const ustr *);
+ustr c2ustr_intern(struct ustr_pool *, const char *);  // no temporary
+Wint ustr_pool_count(struct ustr_pool *);               // distinct strings
+void ustr_pool_free(struct ustr_pool *);
 
 #endif
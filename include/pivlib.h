@@ -39,6 +39,8 @@ typedef intptr_t Zint;
 typedef uintptr_t Nint;
 typedef unsigned char Wchar;
 
+#include "piv_alloc.h"      // needs the types above
+
 Wchar log2floor(Nint);
 Wchar log2ceil(Nint);
 Nint power2N(Wchar);
@@ -47,11 +49,24 @@ Nint geomalloc(Wchar);
 Nint left_geomalloc(Wchar);
 void geofree(Nint, Wchar);
 void left_geofree(Nint, Wchar);
+int geomalloc_hugepages(int);   // NOARCH_HUGE_* mode = previous mode
+
+struct geomalloc_stats {
+    Wint allocs[8*sizeof(Nint)];    // per power, summed over threads
+    Wint frees[8*sizeof(Nint)];
+    Wint live_bytes;
+    Wint peak_bytes;                // high-water mark of live_bytes
+    double seconds;                 // since the first geomalloc()
+};
+void geomalloc_stats(struct geomalloc_stats*);
 Nint NfromW(Wint);
 Nint memcpy(Nint, Nint, Nint);
 Nint r2l_memcpy(Nint, Wint, Wint, Wint);
 //   r2l_memcpy(dest, src, obj_count, obj_size) = rend of dest
 Wint r2r_memcpy(Wint, Wint, Wint, Wint);
+Nint stream_memcpy(Nint, Nint, Nint);
+//   memcpy() through noarch_stream_copy() for disjoint ranges of
+//   noarch_stream_threshold() bytes or more
 
 struct rvec {
     Nint nth;
@@ -138,7 +153,7 @@ union { \
 {slice.structure.rend, slice.state.lvec, slice.structure.vec.v_table};
 
 #define PIVEC(type) \
-{0, 0, &pique};
+{{{0, 0}, &pique}};
 
 #define PIV_INC(slice) \
 (slice.state.lvec = \
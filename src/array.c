@@ -2,8 +2,11 @@
 #include "pivlib.h"
 #include <assert.h>
 #include <stdio.h> // temp?
-
-#define BSEARCH_RETURN_SIZE 4   // in # of elements, not byte size
+#include <stdlib.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ARRAY_X86
+#endif
 
 struct rvec array_rvec_bsearch(const void* key, struct rvec vec, Nint obj_size,
                         int (*cmp)(const Nint, const Nint)
@@ -38,7 +41,482 @@ Nint array_rvec_lsearch(const void* key, struct rvec vec, Nint obj_size,
         vec.nth -= obj_size;
     return vec.nth;
 }
-                        
+
+/*
+ *  Typed linear searches.
+ *
+ *  array_rvec_lsearch_<type>() is array_rvec_lsearch() for an rvec of
+ *  a primitive type compared with < (so a NaN element stops the
+ *  search, as a three-way compare returning 0 would). The vector
+ *  kernels compare 16 or 32 bytes of elements against the key at once,
+ *  still moving from nth toward zero, and the lowest bit of the
+ *  movemask of the stop lanes is the byte offset of the first element
+ *  that is not above the key. Less than a vector at zero is finished by
+ *  the scalar loop.
+ */
+static int array_cpu_features(void) {
+    static int features = -1;
+    if(features < 0)
+        features = noarch_cpu_features();
+    return features;
+}
+
+#define ARRAY_LSEARCH_SCALAR(type)                                       \
+static Nint lsearch_##type##_scalar(type key, Nint it, Nint zero) {     \
+    while(it != zero && key < *(const type*)it)                         \
+        it += sizeof(type);                                             \
+    return it;                                                          \
+}
+
+// above(elements, keys) sets the lanes holding elements above the key
+#define ARRAY_LSEARCH_KERNEL(type, isa, vec, load, set1, above, movemask,\
+                             isa_name)                                  \
+__attribute__((target(isa_name)))                                       \
+static Nint lsearch_##type##_##isa(type key, Nint it, Nint zero) {      \
+    const unsigned all = (unsigned)(((uint64_t)1 << sizeof(vec)) - 1);  \
+    vec keys = set1(key);                                               \
+    for(; zero - it >= sizeof(vec); it += sizeof(vec)) {                \
+        vec elems = load((const vec*)it);                               \
+        unsigned stop = movemask(above(elems, keys)) ^ all;             \
+        if(stop)                                                        \
+            return it + __builtin_ctz(stop);                            \
+    }                                                                   \
+    return lsearch_##type##_scalar(key, it, zero);                      \
+}
+
+#define ARRAY_LSEARCH(type, sse_features)                                \
+Nint array_rvec_lsearch_##type(type key, struct rvec vec) {             \
+    assert(vec.nth <= vec.zero);                                        \
+    int features = array_cpu_features();                                \
+    if(features & NOARCH_CPU_AVX2)                                      \
+        return lsearch_##type##_avx2(key, vec.nth, vec.zero);           \
+    if((features & (sse_features)) == (sse_features))                   \
+        return lsearch_##type##_sse(key, vec.nth, vec.zero);            \
+    return lsearch_##type##_scalar(key, vec.nth, vec.zero);             \
+}
+
+ARRAY_LSEARCH_SCALAR(int8_t)
+ARRAY_LSEARCH_SCALAR(int16_t)
+ARRAY_LSEARCH_SCALAR(int32_t)
+ARRAY_LSEARCH_SCALAR(int64_t)
+ARRAY_LSEARCH_SCALAR(float)
+ARRAY_LSEARCH_SCALAR(double)
+
+#ifdef ARRAY_X86
+#define GT_PS(e, k) _mm_castps_si128(                                    \
+    _mm_cmplt_ps(_mm_castsi128_ps(k), _mm_castsi128_ps(e)))
+#define GT_PD(e, k) _mm_castpd_si128(                                    \
+    _mm_cmplt_pd(_mm_castsi128_pd(k), _mm_castsi128_pd(e)))
+#define GT_PS256(e, k) _mm256_castps_si256(_mm256_cmp_ps(                \
+    _mm256_castsi256_ps(k), _mm256_castsi256_ps(e), _CMP_LT_OQ))
+#define GT_PD256(e, k) _mm256_castpd_si256(_mm256_cmp_pd(                \
+    _mm256_castsi256_pd(k), _mm256_castsi256_pd(e), _CMP_LT_OQ))
+#define SET1_PS(x) _mm_castps_si128(_mm_set1_ps(x))
+#define SET1_PD(x) _mm_castpd_si128(_mm_set1_pd(x))
+#define SET1_PS256(x) _mm256_castps_si256(_mm256_set1_ps(x))
+#define SET1_PD256(x) _mm256_castpd_si256(_mm256_set1_pd(x))
+
+ARRAY_LSEARCH_KERNEL(int8_t, sse, __m128i, _mm_loadu_si128, _mm_set1_epi8,
+                     _mm_cmpgt_epi8, _mm_movemask_epi8, "sse2")
+ARRAY_LSEARCH_KERNEL(int16_t, sse, __m128i, _mm_loadu_si128, _mm_set1_epi16,
+                     _mm_cmpgt_epi16, _mm_movemask_epi8, "sse2")
+ARRAY_LSEARCH_KERNEL(int32_t, sse, __m128i, _mm_loadu_si128, _mm_set1_epi32,
+                     _mm_cmpgt_epi32, _mm_movemask_epi8, "sse2")
+ARRAY_LSEARCH_KERNEL(int64_t, sse, __m128i, _mm_loadu_si128, _mm_set1_epi64x,
+                     _mm_cmpgt_epi64, _mm_movemask_epi8, "sse4.2")
+ARRAY_LSEARCH_KERNEL(float, sse, __m128i, _mm_loadu_si128, SET1_PS,
+                     GT_PS, _mm_movemask_epi8, "sse2")
+ARRAY_LSEARCH_KERNEL(double, sse, __m128i, _mm_loadu_si128, SET1_PD,
+                     GT_PD, _mm_movemask_epi8, "sse2")
+ARRAY_LSEARCH_KERNEL(int8_t, avx2, __m256i, _mm256_loadu_si256,
+                     _mm256_set1_epi8, _mm256_cmpgt_epi8,
+                     _mm256_movemask_epi8, "avx2")
+ARRAY_LSEARCH_KERNEL(int16_t, avx2, __m256i, _mm256_loadu_si256,
+                     _mm256_set1_epi16, _mm256_cmpgt_epi16,
+                     _mm256_movemask_epi8, "avx2")
+ARRAY_LSEARCH_KERNEL(int32_t, avx2, __m256i, _mm256_loadu_si256,
+                     _mm256_set1_epi32, _mm256_cmpgt_epi32,
+                     _mm256_movemask_epi8, "avx2")
+ARRAY_LSEARCH_KERNEL(int64_t, avx2, __m256i, _mm256_loadu_si256,
+                     _mm256_set1_epi64x, _mm256_cmpgt_epi64,
+                     _mm256_movemask_epi8, "avx2")
+ARRAY_LSEARCH_KERNEL(float, avx2, __m256i, _mm256_loadu_si256,
+                     SET1_PS256, GT_PS256,
+                     _mm256_movemask_epi8, "avx2")
+ARRAY_LSEARCH_KERNEL(double, avx2, __m256i, _mm256_loadu_si256,
+                     SET1_PD256, GT_PD256,
+                     _mm256_movemask_epi8, "avx2")
+#else
+#define ARRAY_LSEARCH_SCALAR_ONLY(type)                                        \
+static Nint lsearch_##type##_sse(type key, Nint it, Nint zero) {        \
+    return lsearch_##type##_scalar(key, it, zero);                      \
+}                                                                       \
+static Nint lsearch_##type##_avx2(type key, Nint it, Nint zero) {       \
+    return lsearch_##type##_scalar(key, it, zero);                      \
+}
+ARRAY_LSEARCH_SCALAR_ONLY(int8_t)
+ARRAY_LSEARCH_SCALAR_ONLY(int16_t)
+ARRAY_LSEARCH_SCALAR_ONLY(int32_t)
+ARRAY_LSEARCH_SCALAR_ONLY(int64_t)
+ARRAY_LSEARCH_SCALAR_ONLY(float)
+ARRAY_LSEARCH_SCALAR_ONLY(double)
+#endif
+
+ARRAY_LSEARCH(int8_t, NOARCH_CPU_SSE2)
+ARRAY_LSEARCH(int16_t, NOARCH_CPU_SSE2)
+ARRAY_LSEARCH(int32_t, NOARCH_CPU_SSE2)
+ARRAY_LSEARCH(int64_t, NOARCH_CPU_SSE42)
+ARRAY_LSEARCH(float, NOARCH_CPU_SSE2)
+ARRAY_LSEARCH(double, NOARCH_CPU_SSE2)
+
+/*
+ *  Frozen search index.
+ *
+ *  array_rvec_freeze() copies a sorted rvec into Eytzinger (breadth
+ *  first) order: node k has children 2k and 2k+1 and sits where element
+ *  k-1 of an rvec would. A search then walks down with one comparison
+ *  per level and no unpredictable branch, prefetching the 16 nodes four
+ *  levels below, which the layout keeps in one or two cache lines.
+ *
+ *  array_frozen_bsearch() returns the same insertion point as
+ *  array_rvec_bsearch() followed by array_rvec_lsearch(): its window is
+ *  the last element that is not above key, or empty at zero if every
+ *  element is above key. The source rvec must not change while frozen.
+ */
+static void frozen_build(struct array_frozen* fz, Wint k, Wint n, Nint* it) {
+    while(k <= n) {
+        frozen_build(fz, 2*k, n, it);
+        memcpy(fz->eytz.zero + (k - 1)*fz->obj_size, *it, fz->obj_size);
+        *it += fz->obj_size;
+        k = 2*k + 1;
+    }
+}
+
+// Nodes in the subtree of node k of an n node Eytzinger tree
+static Wint frozen_size(Wint k, Wint n) {
+    if(k > n)
+        return 0;
+    Wchar levels = log2floor(n) - log2floor(k);
+    Wint first_leaf = k << levels;
+    Wint leaves = (n >= first_leaf) ? n - first_leaf + 1 : 0;
+    if(leaves > power2W(levels))
+        leaves = power2W(levels);
+    return power2W(levels) - 1 + leaves;
+}
+
+// In order position of node k
+static Wint frozen_rank(Wint k, Wint n) {
+    Wint rank = frozen_size(2*k, n);
+    for(; k > 1; k >>= 1)
+        if(k & 1)
+            rank += frozen_size(k - 1, n) + 1;
+    return rank;
+}
+
+int array_rvec_freeze(struct array_frozen* fz, struct rvec vec,
+                      Nint obj_size
+) {
+    assert(vec.zero >= vec.nth && obj_size);
+    Nint len = vec.nth - vec.zero;
+    fz->vec = vec;
+    fz->obj_size = obj_size;
+    fz->power = 8*sizeof(Nint);
+    fz->eytz.zero = fz->eytz.nth = 0;
+    if(!len)
+        return 1;
+    Wchar power = log2ceil(len);
+    Nint zero = left_geomalloc(power);
+    if(!zero)
+        return 0;
+    fz->power = power;
+    fz->eytz.zero = zero;
+    fz->eytz.nth = zero + len;
+    Nint it = vec.zero;
+    frozen_build(fz, 1, -len / -obj_size, &it);
+    return 1;
+}
+
+void array_frozen_free(struct array_frozen* fz) {
+    if(fz->power < 8*sizeof(Nint))
+        left_geofree(fz->eytz.zero, fz->power);
+    fz->power = 8*sizeof(Nint);
+    fz->eytz.zero = fz->eytz.nth = 0;
+}
+
+struct rvec array_frozen_bsearch(const void* key,
+                                 const struct array_frozen* fz,
+                                 int (*cmp)(const Nint, const Nint)
+) {
+    Nint zero = fz->eytz.zero, obj_size = fz->obj_size;
+    Wint n = (fz->eytz.zero - fz->eytz.nth) / -obj_size;
+    Wint k = 1;
+    while(k <= n) {
+        __builtin_prefetch((void*)(zero + 16*k*obj_size));
+        __builtin_prefetch((void*)(zero + (16*k + 15)*obj_size));
+        k = 2*k + (cmp((Nint)key, zero + k*obj_size) >= 0);
+    }
+    k >>= __builtin_ffsl(~k);
+    Wint rank = k ? frozen_rank(k, n) : n;
+    struct rvec window;
+    window.nth = fz->vec.zero + rank*obj_size;
+    window.zero = rank ? window.nth - obj_size : window.nth;
+    return window;
+}
+
+/*
+ *  Batched search.
+ *
+ *  array_rvec_bsearch_batch() resolves every key of an rvec against one
+ *  sorted rvec, writing what array_rvec_lsearch() would return after
+ *  array_rvec_bsearch() into the matching element of results. Keys are
+ *  taken ARRAY_BATCH_GROUP at a time. All keys of a group halve the
+ *  same range length on every step, so the group advances one level at
+ *  a time, and each key prefetches its next probe right after it moves.
+ *  By the time the group comes around again that probe has arrived, so
+ *  the cache misses of the group overlap instead of queueing.
+ */
+#define ARRAY_BATCH_GROUP 32
+
+void array_rvec_bsearch_batch(struct rvec keys, Nint key_size,
+                              struct rvec vec, Nint obj_size,
+                              int (*cmp)(const Nint, const Nint),
+                              struct rvec results
+) {
+    assert(vec.zero >= vec.nth && obj_size && key_size);
+    Wint count = (vec.zero - vec.nth) / -obj_size;
+    Wint key_count = (keys.zero - keys.nth) / -key_size;
+    assert(results.zero - results.nth >= key_count * sizeof(Nint));
+    Nint key = keys.zero, result = results.zero;
+    Wint base[ARRAY_BATCH_GROUP];
+    while(key_count) {
+        Wint group = (key_count < ARRAY_BATCH_GROUP)
+                   ? key_count : ARRAY_BATCH_GROUP;
+        for(Wint i = 0; i < group; i++)
+            base[i] = 0;
+        for(Wint n = count; n > 1; ) {
+            Wint half = n / 2;
+            n -= half;
+            for(Wint i = 0; i < group; i++) {
+                Nint probe = vec.zero + (base[i] + half + 1)*obj_size;
+                Nint k = key + (i + 1)*key_size;
+                base[i] += (cmp(k, probe) >= 0) ? half : 0;
+                __builtin_prefetch((void*)
+                    (vec.zero + (base[i] + n/2 + 1)*obj_size));
+            }
+        }
+        for(Wint i = 0; i < group; i++) {
+            Nint k = key + (i + 1)*key_size;
+            Wint rank = base[i];
+            if(count && cmp(k, vec.zero + (rank + 1)*obj_size) >= 0)
+                rank++;
+            result -= sizeof(Nint);
+            *(Nint*)result = vec.zero + rank*obj_size;
+        }
+        key += group*key_size;
+        key_count -= group;
+    }
+}
+
+/*
+ *  Learned index.
+ *
+ *  array_rvec_learn() fits a sorted int64_t rvec with line segments in
+ *  one pass: a segment keeps the cone of slopes that predict every
+ *  position seen so far within epsilon and ends when a point empties
+ *  the cone. array_learned_bsearch() picks the segment by bisecting
+ *  the segment first keys, evaluates it, and returns a window of about
+ *  2*epsilon elements around the prediction that ends in the same
+ *  insertion point as array_rvec_bsearch() would, for
+ *  array_rvec_lsearch_int64_t() to finish. A segment takes 24 bytes,
+ *  so smooth keys need far less memory than an index of the keys.
+ */
+struct learned_segment {
+    int64_t first_key;
+    double slope;
+    Wint first_pos;
+};
+
+static void learned_push(struct array_learned* li, int64_t key,
+                         double slope, Wint pos
+) {
+    struct learned_segment* seg = (struct learned_segment*)
+        array_partback(&li->segments, -(Nint)sizeof(*seg)).nth;
+    seg->first_key = key;
+    seg->slope = slope;
+    seg->first_pos = pos;
+}
+
+int array_rvec_learn(struct array_learned* li, struct rvec vec,
+                     Wint epsilon
+) {
+    assert(vec.zero >= vec.nth);
+    struct array segments = ARRAY_INIT;
+    li->vec = vec;
+    li->segments = segments;
+    li->epsilon = epsilon;
+    Wint count = (vec.zero - vec.nth) / sizeof(int64_t);
+    const int64_t* keys = (const int64_t*)vec.zero - 1;  // keys[-i]
+    if(!count)
+        return 1;
+    int64_t first_key = keys[0];
+    Wint first_pos = 0;
+    double lo = 0, hi = 1.0/0.0;
+    for(Wint i = 1; i < count; i++) {
+        int64_t key = keys[-(Zint)i];
+        double dx = (double)((uint64_t)key - (uint64_t)first_key);
+        double dy = (double)(i - first_pos);
+        double slope_lo = (dy - epsilon) / dx, slope_hi = (dy + epsilon) / dx;
+        if(dx == 0 ? dy > epsilon : (slope_lo > hi || slope_hi < lo)) {
+            learned_push(li, first_key, (hi == 1.0/0.0) ? lo : (lo+hi)/2,
+                         first_pos);
+            first_key = key, first_pos = i;
+            lo = 0, hi = 1.0/0.0;
+            continue;
+        }
+        if(dx != 0) {
+            lo = (slope_lo > lo) ? slope_lo : lo;
+            hi = (slope_hi < hi) ? slope_hi : hi;
+        }
+    }
+    learned_push(li, first_key, (hi == 1.0/0.0) ? lo : (lo+hi)/2, first_pos);
+    return 1;
+}
+
+void array_learned_free(struct array_learned* li) {
+    array_free(&li->segments);
+}
+
+struct rvec array_learned_bsearch(int64_t key,
+                                  const struct array_learned* li
+) {
+    Nint obj_size = -(Nint)sizeof(int64_t);
+    const struct learned_segment* segs =
+        (const struct learned_segment*)li->segments.zero;
+    Wint seg_count = (li->segments.zero - li->segments.nth)
+                   / sizeof(struct learned_segment);
+    Wint count = (li->vec.zero - li->vec.nth) / sizeof(int64_t);
+    struct rvec window = {li->vec.zero, li->vec.zero};
+    if(!seg_count || key < segs[-1].first_key)
+        return window;
+
+    // Last segment starting at or below key
+    Wint base = 0;
+    for(Wint n = seg_count; n > 1; ) {
+        Wint half = n / 2;
+        base += (segs[-1 - (Zint)(base + half)].first_key <= key) ? half : 0;
+        n -= half;
+    }
+    const struct learned_segment* seg = &segs[-1 - (Zint)base];
+    Wint last_pos = (base + 1 < seg_count) ? seg[-1].first_pos - 1
+                                           : count - 1;
+    double dx = (double)((uint64_t)key - (uint64_t)seg->first_key);
+    double guess = seg->first_pos + seg->slope * dx;
+    Wint pos = (guess < last_pos) ? (Wint)guess : last_pos;
+    Wint lo = (pos > seg->first_pos + li->epsilon + 1)
+            ? pos - li->epsilon - 1 : seg->first_pos;
+    Wint hi = (pos + li->epsilon + 1 < last_pos)
+            ? pos + li->epsilon + 1 : last_pos;
+    window.zero = li->vec.zero + lo*obj_size;
+    window.nth = li->vec.zero + (hi + 1)*obj_size;
+    return window;
+}
+
+
+static const struct piv_allocator* array_allocator(struct array* arr) {
+    return arr->alloc ? arr->alloc : &piv_geomalloc;
+}
+
+/*
+ *  Reserved arrays.
+ *
+ *  array_reserve() moves an array to the top of a reserved range of
+ *  2^reserve bytes of address space. Growth then only commits more
+ *  pages below zero, so it never copies and element addresses never
+ *  change. The committed size stays a power of two and at least one
+ *  page, and power records it like the heap block size of an
+ *  ordinary array.
+ */
+static void array_commit(struct array* arr, Nint req_len) {
+    Wchar page_power = log2floor(PIV_PAGE_SIZE);
+    Wchar new_power = log2ceil(req_len);
+    if(new_power < page_power)
+        new_power = page_power;
+    if(new_power > arr->reserve) {
+        printf("array reserve of 2^%d bytes exhausted\n", arr->reserve);
+        exit(EXIT_FAILURE);
+    }
+    Wint old_size = power2W(arr->power);
+    Wint new_size = power2W(new_power);
+    if(noarch_commit(arr->zero - new_size, new_size - old_size)) {
+        printf("array commit of %lu bytes failed\n", new_size);
+        exit(EXIT_FAILURE);
+    }
+    arr->power = new_power;
+}
+
+int array_reserve(struct array* arr, Wchar power) {
+    assert(power < 8*sizeof(Nint));
+    Nint arr_len = arr->nth - arr->zero;
+    Wchar page_power = log2floor(PIV_PAGE_SIZE);
+    Wint reserve_size = power2W(power);
+    if(power < page_power || (arr_len && log2ceil(arr_len) > power))
+        return 0;
+    Nint base = noarch_reserve(reserve_size);
+    if(!base)
+        return 0;
+    struct array new_arr = ARRAY_INIT;
+    new_arr.zero = new_arr.nth = base + reserve_size;
+    new_arr.reserve = power;
+    new_arr.power = page_power;
+    if(noarch_commit(new_arr.zero - power2W(page_power),
+                     power2W(page_power))) {
+        noarch_release(base, reserve_size);
+        return 0;
+    }
+    if(arr_len && log2ceil(arr_len) > page_power)
+        array_commit(&new_arr, arr_len);
+    if(arr_len)
+        new_arr.nth = memcpy(new_arr.zero, arr->zero, arr_len);
+    array_free(arr);
+    *arr = new_arr;
+    return 1;
+}
+
+void array_free(struct array* arr) {
+    const struct piv_allocator* alloc = array_allocator(arr);
+    if(arr->reserve)
+        noarch_release(arr->zero - power2W(arr->reserve),
+                       power2W(arr->reserve));
+    else if(arr->power < 8*sizeof(Nint))
+        alloc->left_free(alloc->context, arr->zero, arr->power);
+    struct array empty = ARRAY_INIT;
+    empty.alloc = arr->alloc;
+    *arr = empty;
+}
+
+/*
+ *  Moves a heap array into a block of 2^power bytes, extending its
+ *  current block in place when the allocator can.
+ */
+static void array_regrow(struct array* arr, Wchar new_power) {
+    const struct piv_allocator* alloc = array_allocator(arr);
+    Nint arr_len = arr->nth - arr->zero;
+    if(arr->power < 8*sizeof(Nint) && alloc->left_grow
+       && alloc->left_grow(alloc->context, arr->zero, arr->power, new_power)) {
+        arr->power = new_power;
+        return;
+    }
+    Nint new_zero = alloc->left_alloc(alloc->context, new_power);
+    if(!new_zero) {
+        printf("array allocation of 2^%d bytes failed\n", new_power);
+        exit(EXIT_FAILURE);
+    }
+    arr->nth = stream_memcpy(new_zero, arr->zero, arr_len);
+    if(arr->power < 8*sizeof(Nint))
+        alloc->left_free(alloc->context, arr->zero, arr->power);
+    arr->zero = new_zero;
+    arr->power = new_power;
+}
 
 struct rvec array_partback(struct array* arr, Nint part_size) {
     assert(part_size);
@@ -46,15 +524,15 @@ struct rvec array_partback(struct array* arr, Nint part_size) {
     Wint arr_size = power2W(arr->power);
     Nint arr_len = arr->nth - arr->zero;
     Nint req_len = arr_len + part_size;
-printf("partback() arr_size = %ld, arr_len = %ld, req_len = %ld\n", arr_size, -arr_len, -req_len);
-    if(arr_size < -req_len) {
-        struct array new_lvec;
-        new_lvec.power = log2ceil(req_len);
-        new_lvec.zero = left_geomalloc(new_lvec.power);
-        empty_part.zero = memcpy(new_lvec.zero, arr->zero, arr_len);
+    if(arr_size < -req_len && arr->reserve) {
+        array_commit(arr, req_len);
+        empty_part.zero = arr->nth;
+        arr->nth = empty_part.nth = empty_part.zero + part_size;
+        return empty_part;
+    } else if(arr_size < -req_len) {
+        array_regrow(arr, log2ceil(req_len));
+        empty_part.zero = arr->nth;
         arr->nth = empty_part.nth = empty_part.zero + part_size;
-        arr->zero = new_lvec.zero;
-        arr->power = new_lvec.power;
         return empty_part;
     } else {
         empty_part.zero = arr->nth;
@@ -63,6 +541,77 @@ printf("partback() arr_size = %ld, arr_len = %ld, req_len = %ld\n", arr_size, -a
     }
 }
 
+/*
+ *  Gap arrays.
+ *
+ *  A gap array keeps its elements in a struct array with a gap between
+ *  the elements before and after the last insertion point. The gap is
+ *  kept as offsets from zero so relocating the array does not disturb
+ *  it, and positions are logical byte offsets from zero as if there
+ *  were no gap. An insert moves the gap to its position, copying only
+ *  the elements in between, and takes its part from the top of the gap.
+ *  A gap too small for a part grows by the part plus 1/16 of the
+ *  elements, rounded up to GAP_ARRAY_ALIGN bytes so that elements below
+ *  the gap keep their alignment, which makes inserts clustered around
+ *  a cursor amortized O(1). gap_array_rvec() closes the gap.
+ */
+#define GAP_ARRAY_ALIGN 64
+
+static Nint gap_array_len(const struct gap_array* ga) {
+    return (ga->array.nth - ga->array.zero) - (ga->gap_nth - ga->gap_zero);
+}
+
+static void gap_array_move(struct gap_array* ga, Nint offset) {
+    Nint zero = ga->array.zero;
+    Nint gap_len = ga->gap_nth - ga->gap_zero;
+    if((Zint)offset > (Zint)ga->gap_zero)
+        memcpy(zero + offset + gap_len, zero + offset, ga->gap_zero - offset);
+    else if(offset != ga->gap_zero)
+        memcpy(zero + ga->gap_zero, zero + ga->gap_nth, offset - ga->gap_zero);
+    ga->gap_zero = offset;
+    ga->gap_nth = offset + gap_len;
+}
+
+struct rvec gap_array_inspart(struct gap_array* ga, Nint offset,
+                              Nint part_size
+) {
+    assert(part_size);
+    assert((Zint)offset <= 0 && (Zint)offset >= (Zint)gap_array_len(ga));
+    gap_array_move(ga, offset);
+    if((Zint)(ga->gap_nth - ga->gap_zero) > (Zint)part_size) {
+        Nint grow = part_size + (Zint)gap_array_len(ga) / 16;
+        grow &= ~(Nint)(GAP_ARRAY_ALIGN - 1);
+        Nint below = ga->array.nth - (ga->array.zero + ga->gap_nth);
+        array_partback(&ga->array, grow);
+        Nint zero = ga->array.zero;
+        memcpy(zero + ga->gap_nth + grow, zero + ga->gap_nth, below);
+        ga->gap_nth += grow;
+    }
+    struct rvec part;
+    part.zero = ga->array.zero + ga->gap_zero;
+    part.nth = part.zero + part_size;
+    ga->gap_zero += part_size;
+    return part;
+}
+
+struct rvec gap_array_rvec(struct gap_array* ga) {
+    Nint zero = ga->array.zero;
+    Nint gap_len = ga->gap_nth - ga->gap_zero;
+    if(gap_len) {
+        memcpy(zero + ga->gap_zero, zero + ga->gap_nth,
+               ga->array.nth - (zero + ga->gap_nth));
+        ga->array.nth -= gap_len;
+        ga->gap_nth = ga->gap_zero;
+    }
+    struct rvec vec = {ga->array.nth, ga->array.zero};
+    return vec;
+}
+
+void gap_array_free(struct gap_array* ga) {
+    array_free(&ga->array);
+    ga->gap_zero = ga->gap_nth = 0;
+}
+
 int rvec_cmp(const struct rvec vec1, const struct rvec vec2,
     size_t inc_size, int(*cmp)(const Nint, const Nint)
 ) {
@@ -70,7 +619,7 @@ int rvec_cmp(const struct rvec vec1, const struct rvec vec2,
     Nint it2 = vec2.zero;
     Nint size1 = vec1.nth - it1;
     Nint size2 = vec2.nth - it2;
-    if(size1 > size2) {
+    if((Zint)size1 > (Zint)size2) {     // vec1 shorter
         while(size1) {
             it1 -= inc_size, it2 -= inc_size, size1 += inc_size;
             int cmp_result = (*cmp)(it1, it2);
@@ -99,20 +648,306 @@ int rvec_cmp(const struct rvec vec1, const struct rvec vec2,
     }
 }
 
+/*
+ *  Trivially comparable rvec_cmp().
+ *
+ *  For elements whose equal bytes mean equal elements, the byte ranges
+ *  are compared from their zero ends 64 bytes at a time with AVX2 (16
+ *  with SSE2, 8 with scalar words) until a vector holds a difference.
+ *  The highest address byte of a vector is nearest zero, so the leading
+ *  zeros of the inverted equality movemask count the equal bytes before
+ *  the first difference. Only the element holding it goes to cmp, or
+ *  with no cmp the differing bytes are compared unsigned, as memcmp()
+ *  would. An element that cmp() still finds equal resumes the scan.
+ */
+typedef uint64_t array_word __attribute__((aligned(1), may_alias));
+
+// = bytes that match below the zero ends a and b, at most n
+static Wint first_diff_scalar(const Wchar* a, const Wchar* b, Wint n) {
+    Wint off = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for(; n - off >= sizeof(array_word); off += sizeof(array_word)) {
+        uint64_t x = *(const array_word*)(a - off - sizeof(array_word))
+                   ^ *(const array_word*)(b - off - sizeof(array_word));
+        if(x)
+            return off + __builtin_clzll(x) / 8;
+    }
+#endif
+    while(off < n && a[-1 - (Zint)off] == b[-1 - (Zint)off])
+        off++;
+    return off;
+}
+
+#ifdef ARRAY_X86
+__attribute__((target("sse2")))
+static Wint first_diff_sse(const Wchar* a, const Wchar* b, Wint n) {
+    Wint off = 0;
+    for(; n - off >= 16; off += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(a - off - 16));
+        __m128i y = _mm_loadu_si128((const __m128i*)(b - off - 16));
+        unsigned diff = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) ^ 0xFFFF;
+        if(diff)
+            return off + __builtin_clz(diff << 16);
+    }
+    return off + first_diff_scalar(a - off, b - off, n - off);
+}
+
+__attribute__((target("avx2")))
+static Wint first_diff_avx2(const Wchar* a, const Wchar* b, Wint n) {
+    Wint off = 0;
+    for(; n - off >= 64; off += 64) {
+        __m256i hi = _mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i*)(a - off - 32)),
+            _mm256_loadu_si256((const __m256i*)(b - off - 32)));
+        __m256i lo = _mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i*)(a - off - 64)),
+            _mm256_loadu_si256((const __m256i*)(b - off - 64)));
+        if((unsigned)_mm256_movemask_epi8(_mm256_and_si256(hi, lo))
+           == 0xFFFFFFFF)
+            continue;
+        unsigned diff = ~(unsigned)_mm256_movemask_epi8(hi);
+        if(diff)
+            return off + __builtin_clz(diff);
+        diff = ~(unsigned)_mm256_movemask_epi8(lo);
+        return off + 32 + __builtin_clz(diff);
+    }
+    for(; n - off >= 32; off += 32) {
+        unsigned diff = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i*)(a - off - 32)),
+            _mm256_loadu_si256((const __m256i*)(b - off - 32))));
+        if(diff)
+            return off + __builtin_clz(diff);
+    }
+    return off + first_diff_scalar(a - off, b - off, n - off);
+}
+#endif
+
+static Wint first_diff(const Wchar* a, const Wchar* b, Wint n) {
+#ifdef ARRAY_X86
+    int features = array_cpu_features();
+    if(features & NOARCH_CPU_AVX2)
+        return first_diff_avx2(a, b, n);
+    if(features & NOARCH_CPU_SSE2)
+        return first_diff_sse(a, b, n);
+#endif
+    return first_diff_scalar(a, b, n);
+}
+
+int rvec_cmp_trivial(const struct rvec vec1, const struct rvec vec2,
+    size_t inc_size, int(*cmp)(const Nint, const Nint)
+) {
+    Wint len1 = vec1.zero - vec1.nth, len2 = vec2.zero - vec2.nth;
+    Wint len = (len1 < len2) ? len1 : len2;
+    Wint done = 0;
+    while(done < len) {
+        const Wchar* a = (const Wchar*)vec1.zero - done;
+        const Wchar* b = (const Wchar*)vec2.zero - done;
+        Wint same = first_diff(a, b, len - done);
+        if(same == len - done)
+            break;
+        if(!cmp)
+            return (a[-1 - (Zint)same] < b[-1 - (Zint)same]) ? -1 : 1;
+        done += (same / inc_size + 1) * inc_size;
+        int cmp_result = (*cmp)(vec1.zero - done, vec2.zero - done);
+        if(cmp_result)
+            return (cmp_result < 0) ? -1 : 1;
+    }
+    return (len1 > len2) - (len1 < len2);
+}
+
+/*
+ *  Hashing.
+ *
+ *  rvec_hash() hashes the bytes of [nth, zero) from nth up. Up to 16
+ *  bytes are read as two overlapping words and folded with one 128 bit
+ *  multiply, as wyhash does, and up to 128 bytes 16 at a time into the
+ *  seed. Longer ranges feed eight 64 bit lanes 64 bytes at a time, as
+ *  xxh3 does: each lane adds the product of the two halves of its data
+ *  word keyed with the secret, plus its neighbour's data word, and the
+ *  lanes are scrambled every 1 KiB and folded pairwise at the end. The
+ *  lanes map onto SSE2 and AVX2 32 bit multiplies, and every kernel
+ *  gives the same hash.
+ */
+#define HASH_STRIPE 64
+#define HASH_SCRAMBLE_STRIPES 16
+#define HASH_PRIME32 0x9E3779B1u
+#define HASH_PRIME64 0x9E3779B185EBCA87u
+
+typedef uint32_t array_u32 __attribute__((aligned(1), may_alias));
+
+static const uint64_t hash_secret[16] = {
+    0x152bf8818ec8d8bdu, 0xd66887a3a5561783u, 0xf266f24a7a44668fu,
+    0x877f77b22c5c6317u, 0x5f0aea68001d5229u, 0x602ac25bf929aa91u,
+    0x3b64d0a991d86fb9u, 0x61f8416310d7543bu, 0x19025fcd669f99ffu,
+    0x1e6248070b1913ddu, 0x3628587ec46bc129u, 0x6022e729fb649d4du,
+    0x6951a33f196ee349u, 0x9cc801420c9a5757u, 0x8dc378970722756fu,
+    0x111b3025829dbeedu
+};
+
+static inline uint64_t hash_mix(uint64_t a, uint64_t b) {
+    unsigned __int128 r = (unsigned __int128)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t hash_r8(const Wchar* p) {
+    return *(const array_word*)p;
+}
+
+static inline uint64_t hash_r4(const Wchar* p) {
+    return *(const array_u32*)p;
+}
+
+static void hash_stripe_scalar(uint64_t* acc, const Wchar* p,
+                               const uint64_t* key
+) {
+    for(int i = 0; i < 8; i++) {
+        uint64_t data = hash_r8(p + 8*i);
+        uint64_t keyed = data ^ key[i];
+        acc[i ^ 1] += data;
+        acc[i] += (keyed & 0xFFFFFFFF) * (keyed >> 32);
+    }
+}
+
+static void hash_lanes_scalar(uint64_t* acc, const Wchar* p, Wint len) {
+    Wint stripes = (len - 1) / HASH_STRIPE;
+    for(Wint s = 0; s < stripes; s++) {
+        hash_stripe_scalar(acc, p + s*HASH_STRIPE, hash_secret + (s & 7));
+        if(s % HASH_SCRAMBLE_STRIPES == HASH_SCRAMBLE_STRIPES - 1)
+            for(int i = 0; i < 8; i++)
+                acc[i] = (acc[i] ^ acc[i] >> 47 ^ hash_secret[8 + i])
+                         * HASH_PRIME32;
+    }
+    hash_stripe_scalar(acc, p + len - HASH_STRIPE, hash_secret + 7);
+}
+
+#ifdef ARRAY_X86
+/*
+ *  The kernels are generated per instruction set from the vector type,
+ *  its intrinsic prefix and width, and the target attribute. Lane i^1
+ *  is the other 64 bit half of lane i's 128 bits, so one shuffle swaps
+ *  the data words for every pair.
+ */
+#define HASH_LANES_KERNEL(isa, vec, pre, bits, isa_name)                \
+__attribute__((target(isa_name)))                                       \
+static void hash_stripe_##isa(vec* acc, const Wchar* p,                 \
+                              const uint64_t* key                       \
+) {                                                                     \
+    for(int v = 0; v < 64 / (int)sizeof(vec); v++) {                    \
+        vec data = pre##_loadu_si##bits((const vec*)p + v);             \
+        vec keyed = pre##_xor_si##bits(data,                            \
+                        pre##_loadu_si##bits((const vec*)key + v));     \
+        vec product = pre##_mul_epu32(keyed,                            \
+                                      pre##_srli_epi64(keyed, 32));     \
+        vec swapped = pre##_shuffle_epi32(data, _MM_SHUFFLE(1,0,3,2));  \
+        acc[v] = pre##_add_epi64(acc[v],                                \
+                                 pre##_add_epi64(product, swapped));    \
+    }                                                                   \
+}                                                                       \
+__attribute__((target(isa_name)))                                       \
+static void hash_lanes_##isa(uint64_t* lanes, const Wchar* p,           \
+                             Wint len                                   \
+) {                                                                     \
+    vec acc[64 / sizeof(vec)], prime = pre##_set1_epi32(HASH_PRIME32);  \
+    for(int v = 0; v < 64 / (int)sizeof(vec); v++)                      \
+        acc[v] = pre##_loadu_si##bits((const vec*)lanes + v);           \
+    Wint stripes = (len - 1) / HASH_STRIPE;                             \
+    for(Wint s = 0; s < stripes; s++) {                                 \
+        hash_stripe_##isa(acc, p + s*HASH_STRIPE,                       \
+                          hash_secret + (s & 7));                       \
+        if(s % HASH_SCRAMBLE_STRIPES != HASH_SCRAMBLE_STRIPES - 1)      \
+            continue;                                                   \
+        for(int v = 0; v < 64 / (int)sizeof(vec); v++) {                \
+            vec x = pre##_xor_si##bits(acc[v],                          \
+                                       pre##_srli_epi64(acc[v], 47));   \
+            x = pre##_xor_si##bits(x, pre##_loadu_si##bits(             \
+                    (const vec*)(hash_secret + 8) + v));                \
+            vec lo = pre##_mul_epu32(x, prime);                         \
+            vec hi = pre##_mul_epu32(pre##_srli_epi64(x, 32), prime);   \
+            acc[v] = pre##_add_epi64(lo, pre##_slli_epi64(hi, 32));     \
+        }                                                               \
+    }                                                                   \
+    hash_stripe_##isa(acc, p + len - HASH_STRIPE, hash_secret + 7);     \
+    for(int v = 0; v < 64 / (int)sizeof(vec); v++)                      \
+        pre##_storeu_si##bits((vec*)lanes + v, acc[v]);                 \
+}
+
+HASH_LANES_KERNEL(sse2, __m128i, _mm, 128, "sse2")
+HASH_LANES_KERNEL(avx2, __m256i, _mm256, 256, "avx2")
+#endif
+
+static void hash_lanes(uint64_t* acc, const Wchar* p, Wint len) {
+#ifdef ARRAY_X86
+    int features = array_cpu_features();
+    if(features & NOARCH_CPU_AVX2)
+        hash_lanes_avx2(acc, p, len);
+    else if(features & NOARCH_CPU_SSE2)
+        hash_lanes_sse2(acc, p, len);
+    else
+#endif
+    hash_lanes_scalar(acc, p, len);
+}
+
+uint64_t rvec_hash(const struct rvec vec, uint64_t seed) {
+    assert(vec.nth <= vec.zero);
+    const Wchar* p = (const Wchar*)vec.nth;
+    Wint len = vec.zero - vec.nth;
+    const uint64_t* key = hash_secret;
+    seed ^= hash_mix(seed ^ key[0], key[1]);
+    uint64_t a, b;
+    if(len <= 16) {
+        if(len >= 4) {
+            Wint mid = (len >> 3) << 2;
+            a = hash_r4(p) << 32 | hash_r4(p + mid);
+            b = hash_r4(p + len - 4) << 32 | hash_r4(p + len - 4 - mid);
+        } else if(len) {
+            a = (uint64_t)p[0] << 16 | (uint64_t)p[len >> 1] << 8 | p[len-1];
+            b = 0;
+        } else
+            a = b = 0;
+    } else if(len <= 128) {
+        Wint i = len;
+        for(; i > 16; i -= 16, p += 16)
+            seed = hash_mix(hash_r8(p) ^ key[1], hash_r8(p + 8) ^ seed);
+        a = hash_r8(p + i - 16);
+        b = hash_r8(p + i - 8);
+    } else {
+        uint64_t acc[8];
+        for(int i = 0; i < 8; i++)
+            acc[i] = key[i] ^ seed;
+        hash_lanes(acc, p, len);
+        uint64_t h = len * HASH_PRIME64 ^ seed;
+        for(int i = 0; i < 4; i++)
+            h += hash_mix(acc[2*i] ^ key[8 + 2*i], acc[2*i + 1] ^ key[9 + 2*i]);
+        a = h, b = h >> 32 ^ len;
+    }
+    unsigned __int128 r = (unsigned __int128)(a ^ key[1]) * (b ^ seed);
+    return hash_mix((uint64_t)r ^ key[0] ^ len, (uint64_t)(r >> 64) ^ key[1]);
+}
+
 int array_inspart(struct array* ary, Nint part_ptr, Nint part_size) {
     assert(part_ptr <= ary->zero && part_ptr >= ary->nth);
+    const struct piv_allocator* alloc = array_allocator(ary);
     Nint first_len = part_ptr - ary->zero;
     Nint second_len = ary->nth - part_ptr;
     Nint third_len = first_len + part_size + second_len;
     Wchar new_power = log2ceil(third_len);
-    if(new_power > ary->power) {
+    if(new_power > ary->power && ary->reserve)
+        array_commit(ary, third_len);
+    if(new_power > ary->power && ary->power < 8*sizeof(Nint)
+       && alloc->left_grow
+       && alloc->left_grow(alloc->context, ary->zero, ary->power, new_power))
+        ary->power = new_power;
+    if(new_power > ary->power || ary->power == 8*sizeof(Nint)) {
         Nint new_zero, new_nth;
-        new_zero = geomalloc(new_power) - power2N(new_power);
-        memcpy(new_zero, ary->zero, first_len);
+        new_zero = alloc->left_alloc(alloc->context, new_power);
+        if(!new_zero)
+            return 0;
+        stream_memcpy(new_zero, ary->zero, first_len);
         new_nth = new_zero + first_len + part_size;
-        memcpy(new_nth, part_ptr, second_len);
+        stream_memcpy(new_nth, part_ptr, second_len);
         new_nth += second_len;
-        geofree(ary->zero + power2N(ary->power), ary->power);
+        if(ary->power < 8*sizeof(Nint))
+            alloc->left_free(alloc->context, ary->zero, ary->power);
         ary->zero = new_zero;
         ary->nth = new_nth;
         ary->power = new_power;
@@ -124,3 +959,41 @@ int array_inspart(struct array* ary, Nint part_ptr, Nint part_size) {
         return 1;
     }
 }
+
+/*
+ *  Merges a sorted batch into a sorted array with one growth. The merge
+ *  runs from the largest objects at nth back toward zero, writing the
+ *  merged tail into the grown space below, so it only ever writes over
+ *  objects it has already moved. Runs from either side are moved with
+ *  one memcpy(). Batch objects go after equal array objects, as
+ *  array_inspart() at array_rvec_lsearch()'s position would put them.
+ *  The batch may not lie in the array.
+ */
+int array_merge(struct array* arr, struct rvec batch, Nint obj_size,
+                int (*cmp)(const Nint, const Nint)
+) {
+    assert(batch.zero >= batch.nth && obj_size);
+    Nint arr_len = arr->nth - arr->zero;
+    if(batch.nth == batch.zero)
+        return 1;
+    array_partback(arr, batch.nth - batch.zero);
+    Nint a = arr->zero + arr_len, b = batch.nth, out = arr->nth;
+    while(b != batch.zero) {
+        Nint run;
+        if(a == arr->zero || cmp(b, a) >= 0) {
+            for(run = b; run != batch.zero
+                         && (a == arr->zero || cmp(run, a) >= 0); )
+                run -= obj_size;
+            memcpy(out + (run - b), run, b - run);
+            out += run - b;
+            b = run;
+        } else {
+            for(run = a; run != arr->zero && cmp(b, run) < 0; )
+                run -= obj_size;
+            memcpy(out + (run - a), run, a - run);
+            out += run - a;
+            a = run;
+        }
+    }
+    return 1;
+}
@@ -15,6 +15,37 @@ int pio_putchar(int c) {
     return putchar(c);
 }
 
+/*
+ *  Dumps the geomalloc() counters: live and peak bytes, the allocation
+ *  rate overall and since the previous dump, and the allocation and
+ *  free counts of every power that has been used.
+ */
+int pio_geomalloc_stats(FILE* stream) {
+    static Wint last_allocs;
+    static double last_seconds;
+    struct geomalloc_stats stats;
+    geomalloc_stats(&stats);
+    Wint allocs = 0;
+    for(Wint p = 0; p < 8*sizeof(Nint); p++)
+        allocs += stats.allocs[p];
+    double interval = stats.seconds - last_seconds;
+    int n = fprintf(stream, "geomalloc: live %lu B, peak %lu B, "
+                    "%.0f allocs/s, %.0f allocs/s since last dump\n",
+                    stats.live_bytes, stats.peak_bytes,
+                    stats.seconds > 0 ? allocs / stats.seconds : 0.0,
+                    interval > 0 ? (allocs - last_allocs) / interval : 0.0);
+    n += fprintf(stream, "%6s %14s %14s %14s\n",
+                 "power", "allocs", "frees", "live blocks");
+    for(Wint p = 0; p < 8*sizeof(Nint); p++)
+        if(stats.allocs[p] || stats.frees[p])
+            n += fprintf(stream, "%6lu %14lu %14lu %14ld\n", p,
+                         stats.allocs[p], stats.frees[p],
+                         (long)(stats.allocs[p] - stats.frees[p]));
+    last_allocs = allocs;
+    last_seconds = stats.seconds;
+    return n;
+}
+
 FILE* pio_fopen(const cstr* filename, const cstr* mode) {
     return fopen(filename, mode);
 }
@@ -0,0 +1,90 @@
+#include "piv_alloc.h"
+#include "pivlib.h"
+#include <assert.h>
+
+static Nint geomalloc_left_alloc(void* context, Wchar power) {
+    (void)context;
+    return left_geomalloc(power);
+}
+
+static void geomalloc_left_free(void* context, Nint lend, Wchar power) {
+    (void)context;
+    left_geofree(lend, power);
+}
+
+const struct piv_allocator piv_geomalloc = {
+    geomalloc_left_alloc,
+    geomalloc_left_free,
+    0,
+    0
+};
+
+// Header at the right end (low address) of every region chunk
+struct region_chunk {
+    Nint next;
+    Wchar power;
+};
+#define REGION_CHUNK_HDR 16
+
+struct piv_allocator region_allocator(struct piv_region* region) {
+    struct piv_allocator alloc = {
+        region_left_alloc,
+        region_left_free,
+        region_left_grow,
+        region
+    };
+    return alloc;
+}
+
+Nint region_left_alloc(void* context, Wchar power) {
+    struct piv_region* region = context;
+    Wint size = power2W(power);
+    if(!region->chunks || region->bump - region->floor < size) {
+        Wchar chunk_power = log2ceil(-(Nint)(size + REGION_CHUNK_HDR));
+        if(chunk_power < PIV_REGION_CHUNK_POWER)
+            chunk_power = PIV_REGION_CHUNK_POWER;
+        Nint chunk = geomalloc(chunk_power);
+        if(!chunk)
+            return 0;
+        struct region_chunk* hdr = (struct region_chunk*)chunk;
+        hdr->next = region->chunks;
+        hdr->power = chunk_power;
+        region->chunks = chunk;
+        region->floor = chunk + REGION_CHUNK_HDR;
+        region->bump = chunk + power2W(chunk_power);
+    }
+    Nint lend = region->bump;
+    region->bump -= size;
+    return lend;
+}
+
+void region_left_free(void* context, Nint lend, Wchar power) {
+    struct piv_region* region = context;
+    if(lend - power2W(power) == region->bump)
+        region->bump = lend;
+}
+
+int region_left_grow(void* context, Nint lend, Wchar old_power,
+                     Wchar new_power
+) {
+    struct piv_region* region = context;
+    assert(new_power >= old_power);
+    Wint extra = power2W(new_power) - power2W(old_power);
+    if(lend - power2W(old_power) != region->bump
+       || region->bump - region->floor < extra)
+        return 0;
+    region->bump -= extra;
+    return 1;
+}
+
+void region_free(struct piv_region* region) {
+    Nint chunk = region->chunks;
+    while(chunk) {
+        struct region_chunk* hdr = (struct region_chunk*)chunk;
+        Nint next = hdr->next;
+        geofree(chunk, hdr->power);
+        chunk = next;
+    }
+    struct piv_region empty = REGION_INIT;
+    *region = empty;
+}
@@ -1,7 +1,15 @@
+#define _GNU_SOURCE     // mremap()
 #include <stdint.h>     // uintptr_t, intptr_t
 #include <unistd.h>     // sbrk(), int getpagesize()
 #include <assert.h>     // assert()
+#include <sys/mman.h>   // mmap(), mprotect(), munmap(), mremap()
+#include <string.h>     // memmove(); pivlib defines its own memcpy()
+#include <stdio.h>      // fopen(), fscanf() of /proc/meminfo
 #include "piv_arch.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>  // streaming stores
+#define NOARCH_X86
+#endif
 
 uintptr_t noarch_sbrk(int inc) {
 	assert(inc >= INTPTR_MIN && inc <= INTPTR_MAX);
@@ -9,3 +17,238 @@ uintptr_t noarch_sbrk(int inc) {
 	return (uintptr_t) sbrk(inc_size);
 }
 
+// Lets tests run the fallback kernels on machines with wider ones
+static int noarch_cpu_allowed = -1;
+
+int noarch_cpu_mask(int mask) {
+	int previous = noarch_cpu_allowed;
+	noarch_cpu_allowed = mask;
+	return previous;
+}
+
+int noarch_cpu_features(void) {
+	int features = 0;
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("sse2"))
+		features |= NOARCH_CPU_SSE2;
+	if(__builtin_cpu_supports("ssse3"))
+		features |= NOARCH_CPU_SSSE3;
+	if(__builtin_cpu_supports("sse4.2"))
+		features |= NOARCH_CPU_SSE42;
+	if(__builtin_cpu_supports("avx2"))
+		features |= NOARCH_CPU_AVX2;
+	if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+		features |= NOARCH_CPU_AVX512;
+#endif
+	return features & noarch_cpu_allowed;
+}
+
+uintptr_t noarch_llc_size(void) {
+	long size = 0;
+#ifdef _SC_LEVEL3_CACHE_SIZE
+	size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+	if(size <= 0)
+		size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+	return (size > 0) ? (uintptr_t) size : (uintptr_t)8 << 20;
+}
+
+/*
+ *  Streaming copies.
+ *
+ *  Non-temporal stores write around the cache, so relocating a block
+ *  much larger than the last level cache does not evict everybody
+ *  else's working set on the way. The destination is aligned for the
+ *  stores by a byte head, and the sfence orders them before returning.
+ */
+static uintptr_t stream_threshold;
+
+static void stream_bytes(unsigned char* d, const unsigned char* s,
+                         uintptr_t n) {
+	while(n--)
+		*d++ = *s++;
+}
+
+#ifdef NOARCH_X86
+__attribute__((target("sse2")))
+static void stream_sse2(unsigned char* d, const unsigned char* s,
+                        uintptr_t n) {
+	for(; n >= 4*sizeof(__m128i); n -= 4*sizeof(__m128i)) {
+		__m128i v0 = _mm_loadu_si128((const __m128i*) s);
+		__m128i v1 = _mm_loadu_si128((const __m128i*) s + 1);
+		__m128i v2 = _mm_loadu_si128((const __m128i*) s + 2);
+		__m128i v3 = _mm_loadu_si128((const __m128i*) s + 3);
+		_mm_stream_si128((__m128i*) d, v0);
+		_mm_stream_si128((__m128i*) d + 1, v1);
+		_mm_stream_si128((__m128i*) d + 2, v2);
+		_mm_stream_si128((__m128i*) d + 3, v3);
+		d += 4*sizeof(__m128i), s += 4*sizeof(__m128i);
+	}
+	_mm_sfence();
+	stream_bytes(d, s, n);
+}
+
+__attribute__((target("avx2")))
+static void stream_avx2(unsigned char* d, const unsigned char* s,
+                        uintptr_t n) {
+	if((uintptr_t) d & 16) {
+		_mm_stream_si128((__m128i*) d, _mm_loadu_si128((const __m128i*) s));
+		d += 16, s += 16, n -= 16;
+	}
+	for(; n >= 4*sizeof(__m256i); n -= 4*sizeof(__m256i)) {
+		__m256i v0 = _mm256_loadu_si256((const __m256i*) s);
+		__m256i v1 = _mm256_loadu_si256((const __m256i*) s + 1);
+		__m256i v2 = _mm256_loadu_si256((const __m256i*) s + 2);
+		__m256i v3 = _mm256_loadu_si256((const __m256i*) s + 3);
+		_mm256_stream_si256((__m256i*) d, v0);
+		_mm256_stream_si256((__m256i*) d + 1, v1);
+		_mm256_stream_si256((__m256i*) d + 2, v2);
+		_mm256_stream_si256((__m256i*) d + 3, v3);
+		d += 4*sizeof(__m256i), s += 4*sizeof(__m256i);
+	}
+	stream_sse2(d, s, n);
+}
+#endif
+
+void noarch_stream_copy(uintptr_t dest, uintptr_t src, uintptr_t bytes) {
+	unsigned char* d = (unsigned char*) dest;
+	const unsigned char* s = (const unsigned char*) src;
+	assert(dest + bytes <= src || src + bytes <= dest);
+#ifdef NOARCH_X86
+	static int features = -1;
+	if(features < 0)
+		features = noarch_cpu_features();
+	if(bytes >= 256 && (features & NOARCH_CPU_SSE2)) {
+		uintptr_t head = -dest & 15;
+		stream_bytes(d, s, head);
+		d += head, s += head, bytes -= head;
+		if(features & NOARCH_CPU_AVX2)
+			stream_avx2(d, s, bytes);
+		else
+			stream_sse2(d, s, bytes);
+		return;
+	}
+#endif
+	memmove(d, s, bytes);
+}
+
+uintptr_t noarch_stream_threshold(uintptr_t bytes) {
+	if(!stream_threshold)
+		stream_threshold = noarch_llc_size();
+	uintptr_t previous = stream_threshold;
+	if(bytes)
+		stream_threshold = bytes;
+	return previous;
+}
+
+/*
+ *  Address space reservation for containers that must never move.
+ *  noarch_reserve() maps inaccessible pages, noarch_commit() makes a
+ *  page aligned subrange of them readable and writable.
+ */
+uintptr_t noarch_reserve(uintptr_t bytes) {
+	void* addr = mmap(0, bytes, PROT_NONE,
+	                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	return (addr == MAP_FAILED) ? 0 : (uintptr_t) addr;
+}
+
+int noarch_commit(uintptr_t addr, uintptr_t bytes) {
+	return mprotect((void*) addr, bytes, PROT_READ | PROT_WRITE);
+}
+
+void noarch_release(uintptr_t addr, uintptr_t bytes) {
+	munmap((void*) addr, bytes);
+}
+
+uintptr_t noarch_map(uintptr_t bytes) {
+	void* addr = mmap(0, bytes, PROT_READ | PROT_WRITE,
+	                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return (addr == MAP_FAILED) ? 0 : (uintptr_t) addr;
+}
+
+// Over maps by one alignment unit and trims to get an aligned range
+uintptr_t noarch_map_aligned(uintptr_t bytes, uintptr_t align) {
+	assert(!(align & (align - 1)));
+	uintptr_t addr = noarch_map(bytes + align);
+	if(!addr)
+		return 0;
+	uintptr_t aligned = (addr + align - 1) & ~(align - 1);
+	if(aligned != addr)
+		munmap((void*) addr, aligned - addr);
+	munmap((void*) (aligned + bytes), addr + align - aligned);
+	return aligned;
+}
+
+/*
+ *  Grows a mapping toward lower addresses for right aligned contents.
+ *  On Linux the old pages are moved by mremap() into the top of the
+ *  new mapping, so only page tables move; elsewhere the bytes are
+ *  copied.
+ */
+uintptr_t noarch_remap_down(uintptr_t addr, uintptr_t old_bytes,
+                            uintptr_t new_bytes) {
+	assert(new_bytes >= old_bytes);
+	uintptr_t new_addr = noarch_map(new_bytes);
+	if(!new_addr)
+		return 0;
+	uintptr_t top = new_addr + new_bytes - old_bytes;
+#ifdef MREMAP_FIXED
+	if(mremap((void*) addr, old_bytes, old_bytes,
+	          MREMAP_MAYMOVE | MREMAP_FIXED, (void*) top) != MAP_FAILED)
+		return new_addr;
+#endif
+	memmove((void*) top, (void*) addr, old_bytes);
+	munmap((void*) addr, old_bytes);
+	return new_addr;
+}
+
+/*
+ *  Huge pages.
+ *
+ *  The huge page size is read once from /proc/meminfo. noarch_map_huge()
+ *  tries the preallocated hugetlb pool first when asked to, and
+ *  otherwise maps ordinary pages aligned on the huge page size and
+ *  marks them MADV_HUGEPAGE, which the kernel may or may not honour.
+ *  Any mode falls back to an ordinary mapping rather than failing.
+ */
+uintptr_t noarch_huge_page_size(void) {
+	static uintptr_t huge_page_size;
+	if(huge_page_size)
+		return huge_page_size;
+	uintptr_t size = PIV_PAGE_SIZE;
+	FILE* meminfo = fopen("/proc/meminfo", "r");
+	if(meminfo) {
+		char line[128];
+		unsigned long kib;
+		while(fgets(line, sizeof(line), meminfo))
+			if(sscanf(line, "Hugepagesize: %lu kB", &kib) == 1) {
+				size = (uintptr_t)kib << 10;
+				break;
+			}
+		fclose(meminfo);
+	}
+	return huge_page_size = size;
+}
+
+uintptr_t noarch_map_huge(uintptr_t bytes, int mode) {
+	uintptr_t huge = noarch_huge_page_size();
+	if(mode == NOARCH_HUGE_NONE || huge <= (uintptr_t) PIV_PAGE_SIZE
+	   || bytes % huge)
+		return noarch_map(bytes);
+#ifdef MAP_HUGETLB
+	if(mode == NOARCH_HUGE_POOL) {
+		void* addr = mmap(0, bytes, PROT_READ | PROT_WRITE,
+		                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if(addr != MAP_FAILED)
+			return (uintptr_t) addr;
+	}
+#endif
+	uintptr_t aligned = noarch_map_aligned(bytes, huge);
+	if(!aligned)
+		return 0;
+#ifdef MADV_HUGEPAGE
+	madvise((void*) aligned, bytes, MADV_HUGEPAGE);
+#endif
+	return aligned;
+}
@@ -0,0 +1,148 @@
+#include "piv_alloc.h"
+#include "pivlib.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+/*
+ *  Binary buddy allocator.
+ *
+ *  Arenas of 2^PIV_BUDDY_ARENA_POWER bytes are mapped aligned on their
+ *  size, so the buddy of a block of 2^power bytes is found by flipping
+ *  bit power of its address. Free blocks sit on one doubly linked list
+ *  per power, threaded through the blocks themselves, and each arena
+ *  keeps a byte per 2^PIV_BUDDY_MIN_POWER slot holding power+1 of the
+ *  free block starting there (0 if none). buddy_free() uses that map to
+ *  coalesce a block with its buddy for as long as the buddy is free.
+ */
+#define PIV_BUDDY_SLOTS (1 << (PIV_BUDDY_ARENA_POWER - PIV_BUDDY_MIN_POWER))
+#define PIV_BUDDY_MAX_ARENAS 256
+
+struct buddy_arena {
+    Nint base;
+    Wchar order[PIV_BUDDY_SLOTS];
+};
+
+struct buddy_block {
+    Nint next, prev;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    struct buddy_arena* arenas[PIV_BUDDY_MAX_ARENAS];
+    int arena_count;
+    Nint available[8*sizeof(Nint)];
+} gbuddy = {PTHREAD_MUTEX_INITIALIZER, {0}, 0, {0}};
+
+static struct buddy_arena* buddy_arena_of(Nint block) {
+    for(int i = 0; i < gbuddy.arena_count; i++)
+        if(block - gbuddy.arenas[i]->base < power2W(PIV_BUDDY_ARENA_POWER))
+            return gbuddy.arenas[i];
+    return 0;
+}
+
+static Wchar* buddy_order(struct buddy_arena* arena, Nint block) {
+    return &arena->order[(block - arena->base) >> PIV_BUDDY_MIN_POWER];
+}
+
+static void buddy_push(struct buddy_arena* arena, Nint block, Wchar power) {
+    struct buddy_block* b = (struct buddy_block*)block;
+    b->prev = 0;
+    b->next = gbuddy.available[power];
+    if(b->next)
+        ((struct buddy_block*)b->next)->prev = block;
+    gbuddy.available[power] = block;
+    *buddy_order(arena, block) = power + 1;
+}
+
+static void buddy_unlink(struct buddy_arena* arena, Nint block, Wchar power) {
+    struct buddy_block* b = (struct buddy_block*)block;
+    if(b->prev)
+        ((struct buddy_block*)b->prev)->next = b->next;
+    else
+        gbuddy.available[power] = b->next;
+    if(b->next)
+        ((struct buddy_block*)b->next)->prev = b->prev;
+    *buddy_order(arena, block) = 0;
+}
+
+static int buddy_grow(void) {
+    if(gbuddy.arena_count == PIV_BUDDY_MAX_ARENAS)
+        return 0;
+    struct buddy_arena* arena = calloc(1, sizeof(*arena));
+    if(!arena)
+        return 0;
+    Wint arena_size = power2W(PIV_BUDDY_ARENA_POWER);
+    arena->base = noarch_map_aligned(arena_size, arena_size);
+    if(!arena->base) {
+        free(arena);
+        return 0;
+    }
+    gbuddy.arenas[gbuddy.arena_count++] = arena;
+    buddy_push(arena, arena->base, PIV_BUDDY_ARENA_POWER);
+    return 1;
+}
+
+int buddy_owns(Nint block) {
+    pthread_mutex_lock(&gbuddy.lock);
+    int owns = buddy_arena_of(block) != 0;
+    pthread_mutex_unlock(&gbuddy.lock);
+    return owns;
+}
+
+Nint buddy_alloc(Wchar power) {
+    assert(power >= PIV_BUDDY_MIN_POWER && power <= PIV_BUDDY_ARENA_POWER);
+    pthread_mutex_lock(&gbuddy.lock);
+    Wchar p = power;
+    while(p <= PIV_BUDDY_ARENA_POWER && !gbuddy.available[p])
+        p++;
+    if(p > PIV_BUDDY_ARENA_POWER) {
+        if(!buddy_grow()) {
+            pthread_mutex_unlock(&gbuddy.lock);
+            return 0;
+        }
+        p = PIV_BUDDY_ARENA_POWER;
+    }
+    Nint block = gbuddy.available[p];
+    struct buddy_arena* arena = buddy_arena_of(block);
+    buddy_unlink(arena, block, p);
+    while(p > power) {
+        --p;
+        buddy_push(arena, block + power2W(p), p);
+    }
+    pthread_mutex_unlock(&gbuddy.lock);
+    return block;
+}
+
+void buddy_free(Nint block, Wchar power) {
+    pthread_mutex_lock(&gbuddy.lock);
+    struct buddy_arena* arena = buddy_arena_of(block);
+    assert(arena);
+    while(power < PIV_BUDDY_ARENA_POWER) {
+        Nint buddy = arena->base + ((block - arena->base) ^ power2W(power));
+        if(*buddy_order(arena, buddy) != power + 1)
+            break;
+        buddy_unlink(arena, buddy, power);
+        block = (buddy < block) ? buddy : block;
+        power++;
+    }
+    buddy_push(arena, block, power);
+    pthread_mutex_unlock(&gbuddy.lock);
+}
+
+void buddy_stats(struct piv_buddy_stats* stats) {
+    stats->free_bytes = stats->largest_free = 0;
+    for(Wchar p = 0; p < 8*sizeof(Nint); p++)
+        stats->free_blocks[p] = 0;
+    pthread_mutex_lock(&gbuddy.lock);
+    stats->arena_bytes = gbuddy.arena_count * power2W(PIV_BUDDY_ARENA_POWER);
+    for(Wchar p = PIV_BUDDY_MIN_POWER; p <= PIV_BUDDY_ARENA_POWER; p++)
+        for(Nint b = gbuddy.available[p]; b;
+            b = ((struct buddy_block*)b)->next) {
+            stats->free_blocks[p]++;
+            stats->free_bytes += power2W(p);
+            if(power2W(p) > stats->largest_free)
+                stats->largest_free = power2W(p);
+        }
+    pthread_mutex_unlock(&gbuddy.lock);
+}
@@ -0,0 +1,243 @@
+#include "pivlib.h"
+#include <assert.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PIV_COPY_X86
+#endif
+
+/*
+ *  Copy kernels.
+ *
+ *  memcpy() copies between right to left vectors named by their zero
+ *  (high) end and r2r_memcpy() between vectors named by their low end.
+ *  Both pick the direction that is safe for overlapping ranges, so they
+ *  have memmove() semantics: data moving to higher addresses over
+ *  itself is copied from the high end down, everything else from the
+ *  low end up, which suits hardware prefetchers. r2l_memcpy() reverses
+ *  the order of objects and may not overlap.
+ *
+ *  The copies have scalar, SSE2, AVX2 and AVX-512 variants and the
+ *  reversal scalar, SSSE3 and AVX2 ones. The widest variant the CPU
+ *  supports is picked at startup from noarch_cpu_features(). Each
+ *  vector step loads before it stores, so overlap is safe at any
+ *  distance.
+ */
+typedef uint64_t piv_word __attribute__((aligned(1), may_alias));
+
+typedef void (*piv_copy_kernel)(Wchar*, const Wchar*, Wint);
+typedef void (*piv_reverse_kernel)(Wchar*, const Wchar*, Wint, Wint);
+
+static void copy_down_scalar(Wchar* d, const Wchar* s, Wint n) {
+    for(; n >= sizeof(piv_word); n -= sizeof(piv_word)) {
+        d -= sizeof(piv_word), s -= sizeof(piv_word);
+        *(piv_word*)d = *(const piv_word*)s;
+    }
+    while(n--)
+        *(--d) = *(--s);
+}
+
+static void copy_up_scalar(Wchar* d, const Wchar* s, Wint n) {
+    for(; n >= sizeof(piv_word); n -= sizeof(piv_word)) {
+        *(piv_word*)d = *(const piv_word*)s;
+        d += sizeof(piv_word), s += sizeof(piv_word);
+    }
+    while(n--)
+        *d++ = *s++;
+}
+
+// Objects of obj_size bytes from s upward land at d downward
+static void reverse_scalar(Wchar* d, const Wchar* s, Wint count,
+                           Wint obj_size
+) {
+    while(count--) {
+        d -= obj_size;
+        copy_up_scalar(d, s, obj_size);
+        s += obj_size;
+    }
+}
+
+#ifdef PIV_COPY_X86
+
+/*
+ *  Vector kernels are generated per instruction set from the vector
+ *  type, its unaligned load and store, and the target attribute.
+ */
+#define PIV_COPY_KERNELS(isa, vec, load, store, isa_name)               \
+__attribute__((target(isa_name)))                                       \
+static void copy_down_##isa(Wchar* d, const Wchar* s, Wint n) {          \
+    for(; n >= 4*sizeof(vec); n -= 4*sizeof(vec)) {                      \
+        d -= 4*sizeof(vec), s -= 4*sizeof(vec);                          \
+        vec v3 = load((const vec*)s + 3);                                \
+        vec v2 = load((const vec*)s + 2);                                \
+        vec v1 = load((const vec*)s + 1);                                \
+        vec v0 = load((const vec*)s);                                    \
+        store((vec*)d + 3, v3);                                          \
+        store((vec*)d + 2, v2);                                          \
+        store((vec*)d + 1, v1);                                          \
+        store((vec*)d, v0);                                              \
+    }                                                                    \
+    for(; n >= sizeof(vec); n -= sizeof(vec)) {                          \
+        d -= sizeof(vec), s -= sizeof(vec);                              \
+        store((vec*)d, load((const vec*)s));                             \
+    }                                                                    \
+    copy_down_scalar(d, s, n);                                           \
+}                                                                        \
+__attribute__((target(isa_name)))                                       \
+static void copy_up_##isa(Wchar* d, const Wchar* s, Wint n) {            \
+    for(; n >= 4*sizeof(vec); n -= 4*sizeof(vec)) {                      \
+        vec v0 = load((const vec*)s);                                    \
+        vec v1 = load((const vec*)s + 1);                                \
+        vec v2 = load((const vec*)s + 2);                                \
+        vec v3 = load((const vec*)s + 3);                                \
+        store((vec*)d, v0);                                              \
+        store((vec*)d + 1, v1);                                          \
+        store((vec*)d + 2, v2);                                          \
+        store((vec*)d + 3, v3);                                          \
+        d += 4*sizeof(vec), s += 4*sizeof(vec);                          \
+    }                                                                    \
+    for(; n >= sizeof(vec); n -= sizeof(vec)) {                          \
+        store((vec*)d, load((const vec*)s));                             \
+        d += sizeof(vec), s += sizeof(vec);                              \
+    }                                                                    \
+    copy_up_scalar(d, s, n);                                             \
+}
+
+PIV_COPY_KERNELS(sse2, __m128i, _mm_loadu_si128, _mm_storeu_si128, "sse2")
+PIV_COPY_KERNELS(avx2, __m256i, _mm256_loadu_si256, _mm256_storeu_si256,
+                 "avx2")
+PIV_COPY_KERNELS(avx512, __m512i, _mm512_loadu_si512, _mm512_storeu_si512,
+                 "avx512f")
+
+// pshufb mask reversing the order of 16/obj_size objects in 16 bytes
+__attribute__((target("ssse3")))
+static __m128i reverse_mask(Wint obj_size) {
+    Wchar mask[16];
+    for(Wint j = 0; j < 16; j++)
+        mask[j] = (16/obj_size - 1 - j/obj_size) * obj_size + j%obj_size;
+    return _mm_loadu_si128((const __m128i*)mask);
+}
+
+__attribute__((target("ssse3")))
+static void reverse_ssse3(Wchar* d, const Wchar* s, Wint count,
+                          Wint obj_size
+) {
+    if(obj_size > 8 || (obj_size & (obj_size - 1))) {
+        reverse_scalar(d, s, count, obj_size);
+        return;
+    }
+    __m128i mask = reverse_mask(obj_size);
+    Wint n = count * obj_size;
+    for(; n >= 16; n -= 16, s += 16) {
+        d -= 16;
+        __m128i v = _mm_loadu_si128((const __m128i*)s);
+        _mm_storeu_si128((__m128i*)d, _mm_shuffle_epi8(v, mask));
+    }
+    reverse_scalar(d, s, n / obj_size, obj_size);
+}
+
+__attribute__((target("avx2")))
+static void reverse_avx2(Wchar* d, const Wchar* s, Wint count,
+                         Wint obj_size
+) {
+    if(obj_size > 16 || (obj_size & (obj_size - 1))) {
+        reverse_scalar(d, s, count, obj_size);
+        return;
+    }
+    __m256i mask = _mm256_broadcastsi128_si256(obj_size < 16
+        ? reverse_mask(obj_size)
+        : _mm_setr_epi8(0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15));
+    Wint n = count * obj_size;
+    for(; n >= 32; n -= 32, s += 32) {
+        d -= 32;
+        __m256i v = _mm256_loadu_si256((const __m256i*)s);
+        v = _mm256_shuffle_epi8(v, mask);
+        v = _mm256_permute4x64_epi64(v, 0x4E);  // swap 128 bit lanes
+        _mm256_storeu_si256((__m256i*)d, v);
+    }
+    reverse_scalar(d, s, n / obj_size, obj_size);
+}
+
+#endif
+
+static void copy_down_init(Wchar*, const Wchar*, Wint);
+static void copy_up_init(Wchar*, const Wchar*, Wint);
+static void reverse_init(Wchar*, const Wchar*, Wint, Wint);
+
+static piv_copy_kernel copy_down = copy_down_init;
+static piv_copy_kernel copy_up = copy_up_init;
+static piv_reverse_kernel reverse = reverse_init;
+
+static void piv_copy_dispatch(void) {
+    piv_copy_kernel down = copy_down_scalar, up = copy_up_scalar;
+    piv_reverse_kernel rev = reverse_scalar;
+#ifdef PIV_COPY_X86
+    int cpu = noarch_cpu_features();
+    if(cpu & NOARCH_CPU_SSE2)
+        down = copy_down_sse2, up = copy_up_sse2;
+    if(cpu & NOARCH_CPU_SSSE3)
+        rev = reverse_ssse3;
+    if(cpu & NOARCH_CPU_AVX2)
+        down = copy_down_avx2, up = copy_up_avx2, rev = reverse_avx2;
+    if(cpu & NOARCH_CPU_AVX512)
+        down = copy_down_avx512, up = copy_up_avx512;
+#endif
+    copy_down = down, copy_up = up, reverse = rev;
+}
+
+__attribute__((constructor))
+static void piv_copy_startup(void) {
+    piv_copy_dispatch();
+}
+
+// In case a copy runs before constructors do
+static void copy_down_init(Wchar* d, const Wchar* s, Wint n) {
+    piv_copy_dispatch();
+    copy_down(d, s, n);
+}
+
+static void copy_up_init(Wchar* d, const Wchar* s, Wint n) {
+    piv_copy_dispatch();
+    copy_up(d, s, n);
+}
+
+static void reverse_init(Wchar* d, const Wchar* s, Wint count,
+                         Wint obj_size
+) {
+    piv_copy_dispatch();
+    reverse(d, s, count, obj_size);
+}
+
+Nint memcpy(Nint dest, Nint src, Nint length) {
+    Wint bytes = -length;
+    if(dest > src && dest - src < bytes)
+        copy_down((Wchar*)dest, (const Wchar*)src, bytes);
+    else if(dest != src)
+        copy_up((Wchar*)(dest - bytes), (const Wchar*)(src - bytes), bytes);
+    return dest - bytes;
+}
+
+Nint r2l_memcpy(Nint dest, Wint src, Wint obj_count, Wint obj_size) {
+    Wint bytes = obj_count * obj_size;
+    assert(dest - bytes >= src + bytes || dest <= src);
+    reverse((Wchar*)dest, (const Wchar*)src, obj_count, obj_size);
+    return dest - bytes;
+}
+
+Wint r2r_memcpy(Wint dest, Wint src, Wint obj_count, Wint obj_size) {
+    Wint bytes = obj_count * obj_size;
+    if(dest < src || dest - src >= bytes)
+        copy_up((Wchar*)dest, (const Wchar*)src, bytes);
+    else if(dest > src)
+        copy_down((Wchar*)(dest + bytes), (const Wchar*)(src + bytes), bytes);
+    return dest + bytes;
+}
+
+Nint stream_memcpy(Nint dest, Nint src, Nint length) {
+    Wint bytes = -length;
+    if(bytes < noarch_stream_threshold(0)
+       || (dest > src && dest - src < bytes)
+       || (src > dest && src - dest < bytes))
+        return memcpy(dest, src, length);
+    noarch_stream_copy(dest - bytes, src - bytes, bytes);
+    return dest - bytes;
+}
@@ -0,0 +1,158 @@
+#include "piv_pma.h"
+#include "pivlib.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define PMA_MIN_SEG_SLOTS 8
+
+static Wint* pma_counts(const struct pma* pma) {
+    return (Wint*)pma->seg_counts.nth;
+}
+
+Wint pma_segment_count(const struct pma* pma) {
+    return (pma->seg_counts.zero - pma->seg_counts.nth) / sizeof(Wint);
+}
+
+struct rvec pma_segment(const struct pma* pma, Wint seg) {
+    struct rvec vec;
+    vec.zero = pma->zero + seg * pma->seg_slots * pma->obj_size;
+    vec.nth = vec.zero + pma_counts(pma)[seg] * pma->obj_size;
+    return vec;
+}
+
+/*
+ *  Every segment holds an object once the set is not empty: a window
+ *  is only spread when it already held an object per segment, and a
+ *  doubled block has fewer segments than objects. So the last segment
+ *  whose first object is not above the key can be found by bisection.
+ */
+Wint pma_segment_of(const struct pma* pma, const void* key) {
+    Wint base = 0;
+    for(Wint n = pma_segment_count(pma); n > 1; ) {
+        Wint half = n / 2;
+        Nint first = pma_segment(pma, base + half).zero + pma->obj_size;
+        base += (pma->cmp((Nint)key, first) >= 0) ? half : 0;
+        n -= half;
+    }
+    return base;
+}
+
+// Gathers segments [first, first+segs) into buf, in order
+static Nint pma_gather(struct pma* pma, Nint buf, Wint first, Wint segs) {
+    for(Wint seg = first; seg < first + segs; seg++) {
+        struct rvec vec = pma_segment(pma, seg);
+        buf = memcpy(buf, vec.zero, vec.nth - vec.zero);
+    }
+    return buf;
+}
+
+// Spreads the rvec evenly over segments [first, first+segs)
+static void pma_spread(struct pma* pma, struct rvec vec, Wint first,
+                       Wint segs
+) {
+    Wint total = (vec.zero - vec.nth) / -pma->obj_size;
+    Wint* counts = pma_counts(pma);
+    for(Wint seg = first; seg < first + segs; seg++) {
+        Wint take = total / segs + (seg - first < total % segs);
+        Nint seg_zero = pma->zero + seg * pma->seg_slots * pma->obj_size;
+        memcpy(seg_zero, vec.zero, take * pma->obj_size);
+        vec.zero += take * pma->obj_size;
+        counts[seg] = take;
+    }
+}
+
+// Inserts obj into a sorted rvec with room below nth
+static Nint pma_place(struct pma* pma, struct rvec vec, const void* obj) {
+    Nint at = array_rvec_lsearch(obj, vec, pma->obj_size, pma->cmp);
+    memcpy(at + pma->obj_size, at, vec.nth - at);
+    memcpy(at, (Nint)obj - pma->obj_size, pma->obj_size);
+    return at + pma->obj_size;
+}
+
+static void pma_resize(struct pma* pma, Wchar power, Nint buf) {
+    Wint slots = power2W(power);
+    Wint seg_slots = PMA_MIN_SEG_SLOTS;
+    while(seg_slots < power)
+        seg_slots *= 2;
+    if(seg_slots > slots)
+        seg_slots = slots;
+    Wchar block_power = log2ceil(slots * pma->obj_size);
+    Nint zero = left_geomalloc(block_power);
+    if(!zero) {
+        printf("pma_resize(): left_geomalloc(%d) failed\n", block_power);
+        exit(EXIT_FAILURE);
+    }
+    if(pma->power < 8*sizeof(Nint))
+        left_geofree(pma->zero, log2ceil(power2W(pma->power)
+                                         * pma->obj_size));
+    array_free(&pma->seg_counts);
+    array_partback(&pma->seg_counts, -(Nint)(slots / seg_slots
+                                             * sizeof(Wint)));
+    pma->zero = zero;
+    pma->power = power;
+    pma->seg_slots = seg_slots;
+    struct rvec vec = {buf + pma->count * pma->obj_size, buf};
+    pma_spread(pma, vec, 0, slots / seg_slots);
+}
+
+Nint pma_insert(struct pma* pma, const void* obj) {
+    if(pma->power == 8*sizeof(Nint))
+        pma_resize(pma, log2floor(PMA_MIN_SEG_SLOTS), 0);
+    Wint seg = pma_segment_of(pma, obj);
+    Wint* counts = pma_counts(pma);
+    if(counts[seg] < pma->seg_slots) {
+        struct rvec vec = pma_segment(pma, seg);
+        counts[seg]++;
+        pma->count++;
+        return pma_place(pma, vec, obj);
+    }
+
+    // Smallest window under its threshold, else the doubled block
+    Wint segs = pma_segment_count(pma);
+    Wchar height = log2floor(segs), level = 0;
+    Wint first = seg, window = 1, held = counts[seg];
+    int grow = 1;
+    while(level < height) {
+        level++;
+        window *= 2;
+        first = seg & ~(window - 1);
+        held = 0;
+        for(Wint i = first; i < first + window; i++)
+            held += counts[i];
+        // held + 1 <= (1 - level / (4 height)) * window slots
+        if(4 * height * (held + 1)
+           <= (4 * height - level) * window * pma->seg_slots) {
+            grow = 0;
+            break;
+        }
+    }
+    if(grow)
+        first = 0, window = segs, held = pma->count;
+    Wchar buf_power = log2ceil((held + 1) * pma->obj_size);
+    Nint buf = left_geomalloc(buf_power);
+    if(!buf) {
+        printf("pma_insert(): left_geomalloc(%d) failed\n", buf_power);
+        exit(EXIT_FAILURE);
+    }
+    struct rvec vec = {pma_gather(pma, buf, first, window), buf};
+    pma_place(pma, vec, obj);
+    vec.nth += pma->obj_size;
+    pma->count++;
+    if(grow)
+        pma_resize(pma, pma->power + 1, buf);
+    else
+        pma_spread(pma, vec, first, window);
+    left_geofree(buf, buf_power);
+    struct rvec home = pma_segment(pma, pma_segment_of(pma, obj));
+    return array_rvec_lsearch(obj, home, pma->obj_size, pma->cmp);
+}
+
+void pma_free(struct pma* pma) {
+    if(pma->power < 8*sizeof(Nint))
+        left_geofree(pma->zero, log2ceil(power2W(pma->power)
+                                         * pma->obj_size));
+    array_free(&pma->seg_counts);
+    pma->power = 8*sizeof(Nint);
+    pma->count = 0;
+}
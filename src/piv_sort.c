@@ -0,0 +1,326 @@
+#include "piv_sort.h"
+#include "pivlib.h"
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef uint16_t piv_u16 __attribute__((aligned(1), may_alias));
+typedef uint32_t piv_u32 __attribute__((aligned(1), may_alias));
+typedef uint64_t piv_u64 __attribute__((aligned(1), may_alias));
+
+/*
+ *  Radix sort.
+ *
+ *  Least significant byte first, so every pass is a stable scatter. Keys
+ *  are read as unsigned integers and mapped to an order preserving
+ *  unsigned key: signed integers flip the sign bit, and floats flip the
+ *  sign bit when positive or every bit when negative. One read pass
+ *  counts all the byte histograms, and a byte that is the same in every
+ *  key skips its pass. Objects ping-pong between the rvec and a
+ *  left_geomalloc() block, and are copied back after an odd number of
+ *  passes.
+ */
+static uint64_t radix_key(Nint obj, Wint offset, Wchar size, Wchar kind) {
+    Nint at = obj + offset;
+    uint64_t key = (size == 1) ? *(const Wchar*)at
+                 : (size == 2) ? *(const piv_u16*)at
+                 : (size == 4) ? *(const piv_u32*)at
+                 : *(const piv_u64*)at;
+    uint64_t sign = (uint64_t)1 << (8*size - 1);
+    if(kind == RVEC_RADIX_INT)
+        key ^= sign;
+    else if(kind == RVEC_RADIX_FLOAT)
+        key = (key & sign) ? ~key & (sign | (sign - 1)) : key | sign;
+    return key;
+}
+
+static void radix_copy(Nint dest, Nint src, Wint size) {
+    if(size == 8)
+        *(piv_u64*)dest = *(const piv_u64*)src;
+    else if(size == 4)
+        *(piv_u32*)dest = *(const piv_u32*)src;
+    else if(size == 16) {
+        ((piv_u64*)dest)[0] = ((const piv_u64*)src)[0];
+        ((piv_u64*)dest)[1] = ((const piv_u64*)src)[1];
+    } else
+        while(size--)
+            *(Wchar*)dest++ = *(const Wchar*)src++;
+}
+
+void rvec_radixsort(struct rvec vec, Nint obj_size, Wint key_offset,
+                    Wchar key_size, Wchar key_kind
+) {
+    assert(vec.zero >= vec.nth && obj_size);
+    assert(key_size == 1 || key_size == 2 || key_size == 4
+           || key_size == 8);
+    assert(key_offset + key_size <= -obj_size);
+    Wint size = -obj_size;
+    Wint count = (vec.zero - vec.nth) / size;
+    if(count < 2)
+        return;
+    Wint (*hist)[256] = calloc(key_size, sizeof(*hist));
+    if(!hist) {
+        printf("rvec_radixsort(): calloc() failed\n");
+        exit(EXIT_FAILURE);
+    }
+    for(Nint obj = vec.nth; obj != vec.zero; obj += size) {
+        uint64_t key = radix_key(obj, key_offset, key_size, key_kind);
+        for(Wchar b = 0; b < key_size; b++)
+            hist[b][(key >> 8*b) & 0xFF]++;
+    }
+
+    Wchar power = log2ceil(vec.nth - vec.zero);
+    Nint buf = left_geomalloc(power);
+    if(!buf) {
+        printf("rvec_radixsort(): left_geomalloc(%d) failed\n", power);
+        exit(EXIT_FAILURE);
+    }
+    Nint src = vec.zero, dest = buf;
+    for(Wchar b = 0; b < key_size; b++) {
+        Wint offset[256], sum = 0;
+        int trivial = 0;
+        for(int d = 0; d < 256; d++) {
+            trivial |= (hist[b][d] == count);
+            offset[d] = sum;
+            sum += hist[b][d];
+        }
+        if(trivial)
+            continue;
+        for(Nint obj = src - size; obj >= src - count*size; obj -= size) {
+            uint64_t key = radix_key(obj, key_offset, key_size, key_kind);
+            Wint at = offset[(key >> 8*b) & 0xFF]++;
+            radix_copy(dest - (at + 1)*size, obj, size);
+        }
+        Nint swap = src;
+        src = dest, dest = swap;
+    }
+    if(src != vec.zero)
+        memcpy(vec.zero, src, vec.nth - vec.zero);
+    left_geofree(buf, power);
+    free(hist);
+}
+
+/*
+ *  Parallel stable merge sort.
+ *
+ *  Fork join over a Chase-Lev deque per thread. A sort task pushes its
+ *  right half, sorts its left half itself and then runs or steals
+ *  tasks until the right half is done, so idle threads take the oldest,
+ *  largest pieces of work. Each level sorts its halves into the other
+ *  of the objects and a geomalloc() buffer and merges them back, and a
+ *  large merge is cut along merge paths into pieces of about
+ *  SORT_MERGE_GRAIN objects that merge independently.
+ */
+#define SORT_DEQUE_SIZE 4096
+#define SORT_LEAF_GRAIN 8192
+#define SORT_MERGE_GRAIN 8192
+#define SORT_MAX_PIECES 64
+#define SORT_MAX_THREADS 256
+
+struct sort_task {
+    int merge;                  // else a sort
+    Wchar *a, *t;               // sort: objects, scratch
+    Wint n;
+    int into_t;                 // sort result in t, else in a
+    const Wchar *left, *right;  // merge: runs into out
+    Wint nl, nr;
+    Wchar* out;
+    atomic_int* pending;        // decremented when done
+};
+
+struct sort_deque {
+    atomic_long top, bottom;
+    struct sort_task* _Atomic tasks[SORT_DEQUE_SIZE];
+};
+
+struct sort_job {
+    const struct piv_sort_kernel* kernel;
+    int threads;
+    atomic_int done;
+    struct sort_deque* deques;
+};
+
+struct sort_worker {
+    struct sort_job* job;
+    int id;
+    unsigned seed;
+};
+
+static void sort_push(struct sort_deque* d, struct sort_task* task) {
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&d->top, memory_order_acquire);
+    assert(b - t < SORT_DEQUE_SIZE);
+    atomic_store_explicit(&d->tasks[b % SORT_DEQUE_SIZE], task,
+                          memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+}
+
+static struct sort_task* sort_pop(struct sort_deque* d) {
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long t = atomic_load_explicit(&d->top, memory_order_relaxed);
+    if(t > b) {
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+        return 0;
+    }
+    struct sort_task* task = atomic_load_explicit(
+        &d->tasks[b % SORT_DEQUE_SIZE], memory_order_relaxed);
+    if(t == b) {
+        if(!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+            memory_order_seq_cst, memory_order_relaxed))
+            task = 0;
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    }
+    return task;
+}
+
+static struct sort_task* sort_steal(struct sort_deque* d) {
+    long t = atomic_load_explicit(&d->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+    if(t >= b)
+        return 0;
+    struct sort_task* task = atomic_load_explicit(
+        &d->tasks[t % SORT_DEQUE_SIZE], memory_order_relaxed);
+    if(!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+        memory_order_seq_cst, memory_order_relaxed))
+        return 0;
+    return task;
+}
+
+static void sort_run(struct sort_worker*, struct sort_task*);
+
+// Runs own or stolen tasks until pending drops to zero
+static void sort_wait(struct sort_worker* w, atomic_int* pending) {
+    struct sort_job* job = w->job;
+    while(atomic_load_explicit(pending, memory_order_acquire)) {
+        struct sort_task* task = sort_pop(&job->deques[w->id]);
+        if(!task) {
+            w->seed = w->seed * 1103515245 + 12345;
+            task = sort_steal(&job->deques[(w->seed >> 16) % job->threads]);
+        }
+        if(task)
+            sort_run(w, task);
+        else
+            sched_yield();
+    }
+}
+
+static void sort_merge(struct sort_worker* w, const Wchar* left, Wint nl,
+                       const Wchar* right, Wint nr, Wchar* out
+) {
+    const struct piv_sort_kernel* kernel = w->job->kernel;
+    Wint total = nl + nr;
+    Wint pieces = total / SORT_MERGE_GRAIN;
+    pieces = (pieces < SORT_MAX_PIECES) ? pieces : SORT_MAX_PIECES;
+    if(w->job->threads == 1 || pieces < 2) {
+        kernel->merge(left, nl, right, nr, out);
+        return;
+    }
+    struct sort_task tasks[SORT_MAX_PIECES];
+    atomic_int pending = pieces - 1;
+    Wint prev_diag = 0, prev_a = 0;
+    for(Wint p = 1; p <= pieces; p++) {
+        Wint diag = total * p / pieces;
+        Wint in_a = (p == pieces) ? nl
+                  : kernel->split(left, nl, right, nr, diag);
+        struct sort_task* task = &tasks[p - 1];
+        task->merge = 1;
+        task->left = left + prev_a * kernel->size;
+        task->nl = in_a - prev_a;
+        task->right = right + (prev_diag - prev_a) * kernel->size;
+        task->nr = (diag - in_a) - (prev_diag - prev_a);
+        task->out = out + prev_diag * kernel->size;
+        task->pending = &pending;
+        if(p > 1)
+            sort_push(&w->job->deques[w->id], task);
+        prev_diag = diag, prev_a = in_a;
+    }
+    kernel->merge(tasks[0].left, tasks[0].nl, tasks[0].right, tasks[0].nr,
+                  tasks[0].out);
+    sort_wait(w, &pending);
+}
+
+static void sort_range(struct sort_worker* w, Wchar* a, Wchar* t, Wint n,
+                       int into_t
+) {
+    const struct piv_sort_kernel* kernel = w->job->kernel;
+    Wint size = kernel->size;
+    if(n <= SORT_LEAF_GRAIN) {
+        kernel->sort(a, n, t);
+        if(into_t)
+            memcpy((Nint)(t + n*size), (Nint)(a + n*size), -(Nint)(n*size));
+        return;
+    }
+    Wint half = n / 2;
+    struct sort_task right = {0, a + half*size, t + half*size, n - half,
+                              !into_t, 0, 0, 0, 0, 0, 0};
+    atomic_int pending = 1;
+    right.pending = &pending;
+    sort_push(&w->job->deques[w->id], &right);
+    sort_range(w, a, t, half, !into_t);
+    sort_wait(w, &pending);
+    Wchar* src = into_t ? a : t;
+    Wchar* dest = into_t ? t : a;
+    sort_merge(w, src, half, src + half*size, n - half, dest);
+}
+
+static void sort_run(struct sort_worker* w, struct sort_task* task) {
+    if(task->merge)
+        w->job->kernel->merge(task->left, task->nl, task->right, task->nr,
+                              task->out);
+    else
+        sort_range(w, task->a, task->t, task->n, task->into_t);
+    atomic_fetch_sub_explicit(task->pending, 1, memory_order_release);
+}
+
+static void* sort_thread(void* arg) {
+    struct sort_worker* w = arg;
+    sort_wait(w, &w->job->done);
+    return 0;
+}
+
+void piv_parallel_sort(struct rvec vec, const struct piv_sort_kernel* kernel,
+                       int threads
+) {
+    assert(vec.zero >= vec.nth && kernel->size);
+    Wint n = (vec.zero - vec.nth) / kernel->size;
+    if(n < 2)
+        return;
+    threads = (threads < 1) ? 1 : threads;
+    threads = (threads > SORT_MAX_THREADS) ? SORT_MAX_THREADS : threads;
+    Wchar power = log2ceil(vec.nth - vec.zero);
+    Nint buf = left_geomalloc(power);
+    struct sort_deque* deques = calloc(threads, sizeof(*deques));
+    struct sort_worker* workers = calloc(threads, sizeof(*workers));
+    pthread_t* tids = calloc(threads, sizeof(*tids));
+    if(!buf || !deques || !workers || !tids) {
+        printf("piv_parallel_sort(): out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    struct sort_job job = {kernel, threads, 1, deques};
+    for(int i = 0; i < threads; i++) {
+        workers[i].job = &job;
+        workers[i].id = i;
+        workers[i].seed = 2*i + 1;
+    }
+    for(int i = 1; i < threads; i++)
+        if(pthread_create(&tids[i], 0, sort_thread, &workers[i])) {
+            printf("piv_parallel_sort(): pthread_create() failed\n");
+            exit(EXIT_FAILURE);
+        }
+    Wchar* t = (Wchar*)(buf - (vec.zero - vec.nth));
+    sort_range(&workers[0], (Wchar*)vec.nth, t, n, 0);
+    atomic_store_explicit(&job.done, 0, memory_order_release);
+    for(int i = 1; i < threads; i++)
+        pthread_join(tids[i], 0);
+    left_geofree(buf, power);
+    free(tids);
+    free(workers);
+    free(deques);
+}
@@ -1,5 +1,9 @@
 #include "piv_string.h"
+#include "array.h"
+#include "piv_alloc.h"
 #include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include "pivlib.h"
@@ -18,7 +22,11 @@ rvec ustr_get_rvec(const ustr* userspace_str) {
     rvec v1;
     v1.rvec.zero = (Nint)userspace_str->str & STRING_PTR_MASK;
     if (v1.rvec.zero)
+#ifdef STRING_USTR_PREFIX
+        v1.rvec.nth = v1.rvec.zero - userspace_str->prefix.len;
+#else
         v1.rvec.nth = userspace_str->rend_offset.rend;
+#endif
     else {
         v1.rvec.zero = (Nint)userspace_str + sizeof(*userspace_str);
         v1.rvec.nth = v1.rvec.zero - userspace_str->ustr.status;
@@ -26,8 +34,90 @@ rvec ustr_get_rvec(const ustr* userspace_str) {
     return v1;
 }
 
+uint32_t ustr_prefix_key(const ustr* userspace_str) {
+    const Wchar* chars = userspace_str->prefix.chars;
+    uint32_t key = 0;
+    for(int i = STRING_USTR_PREFIX_SIZE; i--; )
+        key = key << 8 | chars[i];
+    return key;
+}
+
+#ifdef STRING_USTR_HASH
+typedef uint64_t ustr_word __attribute__((aligned(1), may_alias));
+
+// Lowest word of a heap string's block
+static ustr_word* ustr_hash_slot(Nint zero, Wchar power) {
+    return (ustr_word*)(zero - power2W(power));
+}
+#endif
+
+uint64_t ustr_hash(const ustr* userspace_str) {
+#ifdef STRING_USTR_HASH
+    Nint zero = (Nint)userspace_str->str & STRING_PTR_MASK;
+    if(zero)
+        return *ustr_hash_slot(zero, userspace_str->ustr.status);
+#endif
+    rvec chars = ustr_get_rvec(userspace_str);
+    return rvec_hash(chars.rvec, 0);
+}
+
+int ustr_cmp(const ustr* str1, const ustr* str2) {
+#ifdef STRING_USTR_PREFIX
+    uint32_t key1 = ustr_prefix_key(str1), key2 = ustr_prefix_key(str2);
+    if(key1 != key2)
+        return (key1 < key2) ? -1 : 1;
+#endif
+    rvec vec1 = ustr_get_rvec(str1), vec2 = ustr_get_rvec(str2);
+    return rvec_cmp_trivial(vec1.rvec, vec2.rvec, 1, 0);
+}
+
+int ustr_eq(const ustr* str1, const ustr* str2) {
+    rvec vec1, vec2;
+#ifdef STRING_USTR_PREFIX
+    Wint heap1 = (Wint)str1->str & STRING_PTR_MASK;
+    Wint heap2 = (Wint)str2->str & STRING_PTR_MASK;
+    if(!heap1 && !heap2)
+        return str1->str == str2->str
+               && str1->rend_offset.rend == str2->rend_offset.rend;
+    if(ustr_prefix_key(str1) != ustr_prefix_key(str2))
+        return 0;
+#endif
+    vec1 = ustr_get_rvec(str1), vec2 = ustr_get_rvec(str2);
+    if(vec1.rvec.zero - vec1.rvec.nth != vec2.rvec.zero - vec2.rvec.nth)
+        return 0;
+    return !rvec_cmp_trivial(vec1.rvec, vec2.rvec, 1, 0);
+}
+
+// Header of the heap string of len characters below zero
+static ustr ustr_heap(Nint zero, Wint len, Wchar power) {
+    ustr nustr;
+    nustr.str = (Wchar*) zero;
+    nustr.ustr.status = power;
+#ifdef STRING_USTR_PREFIX
+    if (len > UINT32_MAX) {
+        printf("c2ustr(): string too long for STRING_USTR_PREFIX\n");
+        exit(EXIT_FAILURE);
+    }
+    nustr.prefix.len = len;
+    for (Wint j = 0; j < STRING_USTR_PREFIX_SIZE; j++)
+        nustr.prefix.chars[STRING_USTR_PREFIX_SIZE - 1 - j]
+            = (j < len) ? ((const Wchar*)zero)[-1 - (Zint)j] : 0;
+#else
+    nustr.rend_offset.rend = zero - len;
+#endif
+    return nustr;
+}
+
 ustr c2ustr(const char* cstr) {
+    return c2ustr_with(cstr, &piv_geomalloc);
+}
+
+ustr c2ustr_with(const char* cstr, const struct piv_allocator* alloc) {
     ustr nustr;
+#ifdef STRING_USTR_PREFIX
+    for (Wint j = 0; j < sizeof(nustr); j++)
+        nustr.bytes[j] = 0;
+#endif
     Wint len = 0;
     Nint i = sizeof(nustr.ustr.span);
     Wchar* cursor = (Wchar*)(&nustr) + sizeof(nustr);
@@ -41,24 +131,328 @@ ustr c2ustr(const char* cstr) {
     else {
         while(cstr[len++]);
         len *= -1; // negative to convert Wint len -> Nint len
+#ifdef STRING_USTR_HASH
+        Wchar alloc_size = log2ceil(len - sizeof(ustr_word));
+#else
         Wchar alloc_size = log2ceil(len);
-        cursor = (Wchar*) left_geomalloc(alloc_size);
+#endif
+        cursor = (Wchar*) alloc->left_alloc(alloc->context, alloc_size);
         if(!cursor) {
             printf("geomalloc failure in c2ustr(%s)\n", cstr);
             exit(EXIT_FAILURE);
         }
         r2l_memcpy((Nint)cursor, (Wint)cstr, -len, 1);
-        nustr.str = (Wchar*) cursor;
-        nustr.ustr.status = alloc_size;
-        nustr.rend_offset.rend = ((Nint) cursor) + len;
+        nustr = ustr_heap((Nint)cursor, -len, alloc_size);
+#ifdef STRING_USTR_HASH
+        rvec chars = ustr_get_rvec(&nustr);
+        *ustr_hash_slot((Nint)cursor, alloc_size) = rvec_hash(chars.rvec, 0);
+#endif
    }
     return nustr;
 }
 
 void ustr_free(ustr string) {
+    ustr_free_with(string, &piv_geomalloc);
+}
+
+void ustr_free_with(ustr string, const struct piv_allocator* alloc) {
     Wint str = (Wint)string.str & STRING_PTR_MASK;
     if(str)
-        left_geofree((Nint)str, string.ustr.status);
+        alloc->left_free(alloc->context, (Nint)str, string.ustr.status);
+}
+
+/*
+ *  String sort.
+ *
+ *  Multikey quicksort over entries that hold each ustr with the zero end
+ *  and length of its characters, read once through ustr_get_rvec(), so
+ *  inline and heap strings look the same and no comparison goes back to
+ *  the tagged header. Partitions split three ways on the character at
+ *  the depth they share a prefix to, and the equal part moves one
+ *  character deeper without recursing. Small partitions are insertion
+ *  sorted from their depth. Characters past the end read as 0 and the
+ *  rest as 1 + the byte, so a prefix sorts first. With STRING_USTR_PREFIX
+ *  the first characters come from the entry's copy of the header. The
+ *  sorted ustrs are then written back, which also moves inline
+ *  characters along.
+ */
+#define USTR_SORT_SMALL 16
+
+struct ustr_sort_entry {
+    const Wchar* zero;      // character k at zero[-1-k]
+    Wint len;
+    ustr str;
+};
+
+static inline Wint ustr_sort_char(const struct ustr_sort_entry* e, Wint d) {
+    if(d >= e->len)
+        return 0;
+#ifdef STRING_USTR_PREFIX
+    if(d < STRING_USTR_PREFIX_SIZE)
+        return (Wint)e->str.prefix.chars[STRING_USTR_PREFIX_SIZE - 1 - d] + 1;
+#endif
+    return (Wint)e->zero[-1 - (Zint)d] + 1;
 }
 
+static void ustr_sort_swap(struct ustr_sort_entry* a,
+                           struct ustr_sort_entry* b
+) {
+    struct ustr_sort_entry x = *a;
+    *a = *b;
+    *b = x;
+}
+
+// Whether a sorts before b, given they share their first d characters
+static int ustr_sort_less(const struct ustr_sort_entry* a,
+                          const struct ustr_sort_entry* b, Wint d
+) {
+    Wint end = (a->len < b->len) ? a->len : b->len;
+    for(; d < end; d++)
+        if(a->zero[-1 - (Zint)d] != b->zero[-1 - (Zint)d])
+            return a->zero[-1 - (Zint)d] < b->zero[-1 - (Zint)d];
+    return a->len < b->len;
+}
+
+static void ustr_sort_mkqs(struct ustr_sort_entry* e, Wint n, Wint d) {
+    while(n > USTR_SORT_SMALL) {
+        Wint x = ustr_sort_char(&e[0], d);
+        Wint y = ustr_sort_char(&e[n/2], d);
+        Wint z = ustr_sort_char(&e[n-1], d);
+        Wint pivot = (x < y) ? ((y < z) ? y : (x < z) ? z : x)
+                             : ((x < z) ? x : (y < z) ? z : y);
+        Wint lt = 0, i = 0, gt = n;
+        while(i < gt) {
+            Wint c = ustr_sort_char(&e[i], d);
+            if(c < pivot)
+                ustr_sort_swap(&e[lt++], &e[i++]);
+            else if(c > pivot)
+                ustr_sort_swap(&e[i], &e[--gt]);
+            else
+                i++;
+        }
+        ustr_sort_mkqs(e, lt, d);
+        ustr_sort_mkqs(e + gt, n - gt, d);
+        if(!pivot)
+            return;
+        e += lt, n = gt - lt, d++;
+    }
+    for(Wint i = 1; i < n; i++) {
+        struct ustr_sort_entry x = e[i];
+        Wint j = i;
+        for(; j && ustr_sort_less(&x, &e[j-1], d); j--)
+            e[j] = e[j-1];
+        e[j] = x;
+    }
+}
+
+void rvec_ustrsort(struct rvec vec) {
+    assert(vec.zero >= vec.nth);
+    Wint n = (vec.zero - vec.nth) / sizeof(ustr);
+    if(n < 2)
+        return;
+    Wchar power = log2ceil(-(Nint)(n * sizeof(struct ustr_sort_entry)));
+    Nint buf = left_geomalloc(power);
+    if(!buf) {
+        printf("rvec_ustrsort(): left_geomalloc(%d) failed\n", power);
+        exit(EXIT_FAILURE);
+    }
+    struct ustr_sort_entry* e = (struct ustr_sort_entry*)buf - n;
+    ustr* strs = (ustr*)vec.zero;
+    for(Wint k = 0; k < n; k++) {
+        rvec chars = ustr_get_rvec(&strs[-1 - (Zint)k]);
+        e[k].zero = (const Wchar*)chars.rvec.zero;
+        e[k].len = chars.rvec.zero - chars.rvec.nth;
+        e[k].str = strs[-1 - (Zint)k];
+    }
+    ustr_sort_mkqs(e, n, 0);
+    for(Wint k = 0; k < n; k++)
+        strs[-1 - (Zint)k] = e[k].str;
+    left_geofree(buf, power);
+}
+
+
 
+/*
+ *  The pool keeps, per shard, an open addressing table of pointers to
+ *  nodes, probed linearly from the low hash bits; the top bits pick the
+ *  shard. A node and its characters share one region block, characters
+ *  at the top as a heap string's are. An insert fills the node before
+ *  publishing its slot, and a full table is rehashed into one twice the
+ *  size that replaces it, so a lookup racing an insert sees a complete
+ *  node or misses and retries under the lock. Replaced tables are kept
+ *  until the pool is freed, as readers may still be probing them. The
+ *  node's hash is the lowest word of the block, where STRING_USTR_HASH
+ *  looks for it, so interned ustrs hash without rehashing too.
+ */
+#define USTR_POOL_MIN_SLOTS 64
+
+struct ustr_pool_node {
+    uint64_t hash;
+    ustr str;
+};
+
+struct ustr_pool_table {
+    struct ustr_pool_table* older;
+    Wint mask;
+    struct ustr_pool_node* _Atomic slots[];
+};
+
+struct ustr_pool_shard {
+    struct ustr_pool_table* _Atomic table;
+    Wint count;
+    pthread_mutex_t lock;
+    struct piv_region region;
+} __attribute__((aligned(64)));
+
+struct ustr_pool {
+    struct ustr_pool_shard shards[USTR_POOL_SHARDS];
+};
+
+static struct ustr_pool_table* ustr_pool_table_new(Wint slots) {
+    struct ustr_pool_table* table = calloc(1, sizeof(*table)
+                                    + slots * sizeof(table->slots[0]));
+    if (!table) {
+        printf("ustr_pool: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    table->mask = slots - 1;
+    return table;
+}
+
+struct ustr_pool* ustr_pool_new(void) {
+    struct ustr_pool* pool = aligned_alloc(64, sizeof(*pool));
+    if (!pool) {
+        printf("ustr_pool_new(): out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < USTR_POOL_SHARDS; i++) {
+        struct ustr_pool_shard* shard = &pool->shards[i];
+        atomic_init(&shard->table, ustr_pool_table_new(USTR_POOL_MIN_SLOTS));
+        shard->count = 0;
+        pthread_mutex_init(&shard->lock, 0);
+        struct piv_region region = REGION_INIT;
+        shard->region = region;
+    }
+    return pool;
+}
+
+static struct ustr_pool_node* ustr_pool_find(struct ustr_pool_table* table,
+                                             uint64_t hash, struct rvec vec
+) {
+    Wint len = vec.zero - vec.nth;
+    for (Wint i = hash & table->mask; ; i = (i + 1) & table->mask) {
+        struct ustr_pool_node* node = atomic_load_explicit(
+            &table->slots[i], memory_order_acquire);
+        if (!node)
+            return 0;
+        if (node->hash != hash)
+            continue;
+        rvec chars = ustr_get_rvec(&node->str);
+        if (chars.rvec.zero - chars.rvec.nth == len
+            && !rvec_cmp_trivial(chars.rvec, vec, 1, 0))
+            return node;
+    }
+}
+
+static void ustr_pool_put(struct ustr_pool_table* table,
+                          struct ustr_pool_node* node
+) {
+    Wint i = node->hash & table->mask;
+    while (atomic_load_explicit(&table->slots[i], memory_order_relaxed))
+        i = (i + 1) & table->mask;
+    atomic_store_explicit(&table->slots[i], node, memory_order_release);
+}
+
+static ustr ustr_intern_rvec(struct ustr_pool* pool, struct rvec vec) {
+    Wint len = vec.zero - vec.nth;
+    uint64_t hash = rvec_hash(vec, 0);
+    struct ustr_pool_shard* shard = &pool->shards[hash >> 58];
+    struct ustr_pool_node* node = ustr_pool_find(
+        atomic_load_explicit(&shard->table, memory_order_acquire), hash, vec);
+    if (node)
+        return node->str;
+
+    pthread_mutex_lock(&shard->lock);
+    struct ustr_pool_table* table = atomic_load_explicit(
+        &shard->table, memory_order_relaxed);
+    node = ustr_pool_find(table, hash, vec);
+    if (!node) {
+        Wchar power = log2ceil(-(Nint)(sizeof(*node) + len));
+        Nint zero = region_left_alloc(&shard->region, power);
+        if (!zero) {
+            printf("ustr_intern(): region_left_alloc(%d) failed\n", power);
+            exit(EXIT_FAILURE);
+        }
+        node = (struct ustr_pool_node*)(zero - power2W(power));
+        if (len)
+            memcpy(zero, vec.zero, -len);
+        node->hash = hash;
+        node->str = ustr_heap(zero, len, power);
+        if (4 * (shard->count + 1) > 3 * (table->mask + 1)) {
+            struct ustr_pool_table* bigger
+                = ustr_pool_table_new(2 * (table->mask + 1));
+            for (Wint i = 0; i <= table->mask; i++) {
+                struct ustr_pool_node* old = atomic_load_explicit(
+                    &table->slots[i], memory_order_relaxed);
+                if (old)
+                    ustr_pool_put(bigger, old);
+            }
+            bigger->older = table;
+            table = bigger;
+        }
+        ustr_pool_put(table, node);
+        atomic_store_explicit(&shard->table, table, memory_order_release);
+        shard->count++;
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return node->str;
+}
+
+ustr ustr_intern(struct ustr_pool* pool, const ustr* string) {
+    rvec chars = ustr_get_rvec(string);
+    return ustr_intern_rvec(pool, chars.rvec);
+}
+
+ustr c2ustr_intern(struct ustr_pool* pool, const char* cstr) {
+    Wchar buf[256];
+    Wint len = 0;
+    Wchar* cursor = buf + sizeof(buf);
+    if (cstr)
+        do *(--cursor) = cstr[len];
+        while (cstr[len++] && cursor != buf);
+    else
+        *(--cursor) = 0, len = 1;
+    if (cursor[0]) {
+        ustr temp = c2ustr(cstr);   // longer than buf
+        ustr canonical = ustr_intern(pool, &temp);
+        ustr_free(temp);
+        return canonical;
+    }
+    struct rvec vec = {(Nint)cursor, (Nint)(buf + sizeof(buf))};
+    return ustr_intern_rvec(pool, vec);
+}
+
+Wint ustr_pool_count(struct ustr_pool* pool) {
+    Wint count = 0;
+    for (int i = 0; i < USTR_POOL_SHARDS; i++) {
+        pthread_mutex_lock(&pool->shards[i].lock);
+        count += pool->shards[i].count;
+        pthread_mutex_unlock(&pool->shards[i].lock);
+    }
+    return count;
+}
+
+void ustr_pool_free(struct ustr_pool* pool) {
+    for (int i = 0; i < USTR_POOL_SHARDS; i++) {
+        struct ustr_pool_shard* shard = &pool->shards[i];
+        struct ustr_pool_table* table = atomic_load(&shard->table);
+        while (table) {
+            struct ustr_pool_table* older = table->older;
+            free(table);
+            table = older;
+        }
+        region_free(&shard->region);
+        pthread_mutex_destroy(&shard->lock);
+    }
+    free(pool);
+}
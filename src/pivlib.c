@@ -1,61 +1,315 @@
 #include "pivlib.h"
 #include <assert.h>
 #include <stdlib.h>
-#include <stdio.h> // temp debug
+#include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
 
-Nint left_geomalloc(Wchar power) {
-    Wint bytes = 1 << power;
+/*
+ *  Geometric allocator.
+ *
+ *  Every block handed out by geomalloc() is exactly 2^power bytes, so
+ *  freed blocks are kept on one singly linked free list per power and
+ *  reused in O(1). The link to the next free block is stored in the
+ *  first word of the free block itself, which is why powers below
+ *  PIV_GEOMALLOC_MIN_POWER are rounded up.
+ *
+ *  Small powers are served from a per-thread cache. Each cache carves
+ *  its misses from segments of 2^PIV_GEOMALLOC_SEGMENT_POWER bytes,
+ *  aligned on their size, whose header records the owning cache. A
+ *  block freed by another thread is pushed onto the owner's lock-free
+ *  remote list for that power, and the owner takes the whole remote
+ *  list back with one atomic exchange when its local list runs dry.
+ *
+ *  Segments, and blocks too large for a segment, come from the buddy
+ *  allocator in piv_buddy.c, which coalesces them again on geofree().
+ *  Caches of exited threads are adopted by new threads, so neither
+ *  segments nor remote lists are ever left without an owner.
+ *
+ *  With geomalloc_hugepages() set, new blocks of power
+ *  PIV_GEOMALLOC_HUGE_POWER and up are mapped on huge pages instead.
+ *  Those, and blocks larger than a buddy arena, share one mutex
+ *  protected set of free lists. The mode only affects blocks allocated
+ *  after it is set.
+ *
+ *  Telemetry counters live in the thread caches too, written only by
+ *  their thread and summed by geomalloc_stats(). Live bytes are kept
+ *  as a per-thread delta that is folded into the shared total, and the
+ *  high-water mark, whenever it passes PIV_GEOMALLOC_STATS_FLUSH, so
+ *  the peak is exact to within that much per thread.
+ */
+#define PIV_GEOMALLOC_POWERS (8*sizeof(Nint))
+#define PIV_GEOMALLOC_MIN_POWER 3       // log2(sizeof(Nint))
+#define PIV_GEOMALLOC_SEGMENT_POWER 20  // 1 MiB segments
+#define PIV_GEOMALLOC_SEGMENT_HDR 64    // keeps carved blocks aligned
+#define PIV_GEOMALLOC_HUGE_POWER 21     // 2 MiB
+#define PIV_GEOMALLOC_STATS_FLUSH ((Zint)1 << 20)
+
+#if PIV_GEOMALLOC_SEGMENT_POWER != PIV_BUDDY_MIN_POWER
+#error "geomalloc segments must be the smallest buddy blocks"
+#endif
+
+struct piv_geometric_alloc_obj {
+    Nint available[PIV_GEOMALLOC_POWERS];  // free list heads, 0 = empty
+    Nint bottom, top;                      // unused part of segment
+    _Atomic Nint remote[PIV_GEOMALLOC_POWERS];
+    struct piv_geometric_alloc_obj* next_orphan;
+    struct piv_geometric_alloc_obj* next_cache;  // every cache ever made
+    _Atomic Wint allocs[PIV_GEOMALLOC_POWERS];
+    _Atomic Wint frees[PIV_GEOMALLOC_POWERS];
+    _Atomic Zint live_delta;
+};
+
+struct piv_geometric_segment {
+    struct piv_geometric_alloc_obj* owner;
+};
+
+static _Thread_local struct piv_geometric_alloc_obj* galloc_obj;
+static pthread_key_t galloc_key;
+static pthread_once_t galloc_key_once = PTHREAD_ONCE_INIT;
+
+static struct {
+    pthread_mutex_t lock;
+    Nint available[PIV_GEOMALLOC_POWERS];
+    struct piv_geometric_alloc_obj* orphans;
+    struct piv_geometric_alloc_obj* _Atomic caches;
+    _Atomic Zint live_bytes;
+    _Atomic Zint peak_bytes;
+    struct timespec start;
+} galloc_shared = {PTHREAD_MUTEX_INITIALIZER, {0}, 0, 0, 0, 0, {0, 0}};
+
+static atomic_int galloc_huge_mode = NOARCH_HUGE_NONE;
+
+int geomalloc_hugepages(int mode) {
+    return atomic_exchange(&galloc_huge_mode, mode);
+}
+
+static Nint geomalloc_map(Wchar power) {
+    int mode = atomic_load_explicit(&galloc_huge_mode, memory_order_relaxed);
+    if(mode != NOARCH_HUGE_NONE && power >= PIV_GEOMALLOC_HUGE_POWER)
+        return noarch_map_huge(power2W(power), mode);
+    if(power <= PIV_BUDDY_ARENA_POWER)
+        return buddy_alloc(power);
+    return (Nint)malloc(power2W(power));
+}
+
+static void geomalloc_orphan(void* cache) {
+    struct piv_geometric_alloc_obj* obj = cache;
+    pthread_mutex_lock(&galloc_shared.lock);
+    obj->next_orphan = galloc_shared.orphans;
+    galloc_shared.orphans = obj;
+    pthread_mutex_unlock(&galloc_shared.lock);
+}
+
+static void geomalloc_make_key(void) {
+    pthread_key_create(&galloc_key, geomalloc_orphan);
+    clock_gettime(CLOCK_MONOTONIC, &galloc_shared.start);
+}
 
-    Nint lptr = (Nint)malloc(bytes) + bytes;
-    printf("left_geomalloc() %ld bytes at %ld\n", bytes, lptr);
-    return lptr;
+static struct piv_geometric_alloc_obj* geomalloc_cache(void) {
+    if(galloc_obj)
+        return galloc_obj;
+    pthread_once(&galloc_key_once, geomalloc_make_key);
+    pthread_mutex_lock(&galloc_shared.lock);
+    struct piv_geometric_alloc_obj* obj = galloc_shared.orphans;
+    if(obj)
+        galloc_shared.orphans = obj->next_orphan;
+    pthread_mutex_unlock(&galloc_shared.lock);
+    if(!obj) {
+        obj = calloc(1, sizeof(*obj));
+        if(!obj) {
+            printf("geomalloc failure allocating a thread cache\n");
+            exit(EXIT_FAILURE);
+        }
+        obj->next_cache = atomic_load(&galloc_shared.caches);
+        while(!atomic_compare_exchange_weak(&galloc_shared.caches,
+                                            &obj->next_cache, obj));
+    }
+    obj->next_orphan = 0;
+    pthread_setspecific(galloc_key, obj);
+    return galloc_obj = obj;
 }
 
-Nint memcpy(Nint dest, Nint src, Nint length) {
-    assert( !(dest < src && dest >= (src+length)));
-    Wchar* dest_ptr = (Wchar*) dest;
-    Wchar* src_ptr = (Wchar*) src;
-    while(length++)
-        *(--dest_ptr) = *(--src_ptr);
-    return (Nint) dest_ptr;
+static void geomalloc_count(_Atomic Wint* counter) {
+    atomic_store_explicit(counter,
+        atomic_load_explicit(counter, memory_order_relaxed) + 1,
+        memory_order_relaxed);
 }
 
-Nint r2l_memcpy(Nint dest, Wint src, Wint obj_count, Wint obj_size) {
-    assert((dest - src) > obj_count * obj_size);
-    Nint dest_ptr = dest;
-    do {
-        src += obj_size;
-        dest_ptr = memcpy(dest_ptr, src, -obj_size);
-    } while (--obj_count);
-    return dest_ptr;
+static void geomalloc_live(struct piv_geometric_alloc_obj* obj, Zint bytes) {
+    Zint delta = atomic_load_explicit(&obj->live_delta, memory_order_relaxed)
+               + bytes;
+    if(delta < PIV_GEOMALLOC_STATS_FLUSH
+       && delta > -PIV_GEOMALLOC_STATS_FLUSH) {
+        atomic_store_explicit(&obj->live_delta, delta, memory_order_relaxed);
+        return;
+    }
+    atomic_store_explicit(&obj->live_delta, 0, memory_order_relaxed);
+    Zint live = atomic_fetch_add_explicit(&galloc_shared.live_bytes, delta,
+                                          memory_order_relaxed) + delta;
+    Zint peak = atomic_load_explicit(&galloc_shared.peak_bytes,
+                                     memory_order_relaxed);
+    while(live > peak && !atomic_compare_exchange_weak_explicit(
+            &galloc_shared.peak_bytes, &peak, live,
+            memory_order_relaxed, memory_order_relaxed));
 }
 
-Wint r2r_memcpy(Wint dest, Wint src, Wint obj_count, Wint obj_size) {
-    Wint bytes = obj_count * obj_size;
-    assert(((dest-src) >= bytes) || (src-dest) >= bytes);
-    Wchar *d, *s;
-    while(bytes--)
-        *d++ = *s++;
-    return (Wint)d;
+void geomalloc_stats(struct geomalloc_stats* stats) {
+    Zint live = atomic_load(&galloc_shared.live_bytes);
+    for(Wchar p = 0; p < PIV_GEOMALLOC_POWERS; p++)
+        stats->allocs[p] = stats->frees[p] = 0;
+    struct piv_geometric_alloc_obj* obj = atomic_load(&galloc_shared.caches);
+    for(; obj; obj = obj->next_cache) {
+        for(Wchar p = 0; p < PIV_GEOMALLOC_POWERS; p++) {
+            stats->allocs[p] += atomic_load_explicit(&obj->allocs[p],
+                                                     memory_order_relaxed);
+            stats->frees[p] += atomic_load_explicit(&obj->frees[p],
+                                                    memory_order_relaxed);
+        }
+        live += atomic_load_explicit(&obj->live_delta, memory_order_relaxed);
+    }
+    Zint peak = atomic_load(&galloc_shared.peak_bytes);
+    live = (live > 0) ? live : 0;
+    peak = (peak > live) ? peak : live;
+    stats->live_bytes = (Wint)live;
+    stats->peak_bytes = (Wint)peak;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    stats->seconds = (now.tv_sec - galloc_shared.start.tv_sec)
+                   + (now.tv_nsec - galloc_shared.start.tv_nsec) * 1e-9;
+}
+
+static Wchar geomalloc_class(Wchar power) {
+    assert(power < PIV_GEOMALLOC_POWERS);
+    return (power < PIV_GEOMALLOC_MIN_POWER) ? PIV_GEOMALLOC_MIN_POWER
+                                             : power;
+}
+
+static int geomalloc_is_small(Wchar power) {
+    return power2W(power)
+        <= power2W(PIV_GEOMALLOC_SEGMENT_POWER) - PIV_GEOMALLOC_SEGMENT_HDR;
+}
+
+static void geomalloc_push(struct piv_geometric_alloc_obj* obj,
+                           Nint block, Wchar power
+) {
+    *(Nint*)block = obj->available[power];
+    obj->available[power] = block;
+}
+
+static void geomalloc_remote_push(struct piv_geometric_alloc_obj* owner,
+                                  Nint block, Wchar power
+) {
+    Nint head = atomic_load_explicit(&owner->remote[power],
+                                     memory_order_relaxed);
+    do *(Nint*)block = head;
+    while(!atomic_compare_exchange_weak_explicit(&owner->remote[power],
+            &head, block, memory_order_release, memory_order_relaxed));
+}
+
+static Nint geomalloc_carve(struct piv_geometric_alloc_obj* obj,
+                            Wchar power
+) {
+    Wint bytes = power2W(power);
+    if(obj->top - obj->bottom < bytes) {
+        // Split the remainder of the old segment into smaller free blocks
+        Wchar p = power;
+        while(p-- > PIV_GEOMALLOC_MIN_POWER)
+            if(obj->top - obj->bottom >= power2W(p)) {
+                geomalloc_push(obj, obj->bottom, p);
+                obj->bottom += power2W(p);
+            }
+        Nint seg = buddy_alloc(PIV_GEOMALLOC_SEGMENT_POWER);
+        if(!seg)
+            return 0;
+        ((struct piv_geometric_segment*)seg)->owner = obj;
+        obj->bottom = seg + PIV_GEOMALLOC_SEGMENT_HDR;
+        obj->top = seg + power2W(PIV_GEOMALLOC_SEGMENT_POWER);
+    }
+    Nint block = obj->bottom;
+    obj->bottom += bytes;
+    return block;
+}
+
+Nint left_geomalloc(Wchar power) {
+    Wint bytes = power2W(power);
+    Nint rptr = geomalloc(power);
+    if(!rptr)
+        return 0;
+    return rptr + bytes;
 }
 
 Nint NfromW(Wint w) {
     return -w;
 }
 
+static Nint geomalloc_block(struct piv_geometric_alloc_obj* obj,
+                            Wchar power
+) {
+    Nint block;
+    if(!geomalloc_is_small(power)) {
+        block = 0;
+        pthread_mutex_lock(&galloc_shared.lock);
+        if(galloc_shared.available[power]) {
+            block = galloc_shared.available[power];
+            galloc_shared.available[power] = *(Nint*)block;
+        }
+        pthread_mutex_unlock(&galloc_shared.lock);
+        return block ? block : geomalloc_map(power);
+    }
+    block = obj->available[power];
+    if(!block)
+        block = atomic_exchange_explicit(&obj->remote[power], 0,
+                                         memory_order_acquire);
+    if(block) {
+        obj->available[power] = *(Nint*)block;
+        return block;
+    }
+    return geomalloc_carve(obj, power);
+}
+
 Nint geomalloc(Wchar power) {
-    return (Nint)malloc(1 << power);
+    power = geomalloc_class(power);
+    struct piv_geometric_alloc_obj* obj = geomalloc_cache();
+    Nint block = geomalloc_block(obj, power);
+    if(block) {
+        geomalloc_count(&obj->allocs[power]);
+        geomalloc_live(obj, power2W(power));
+    }
+    return block;
 }
 
 void geofree(Nint rend, Wchar power) {
-    free((void*) rend);
+    if(!rend)
+        return;
+    power = geomalloc_class(power);
+    struct piv_geometric_alloc_obj* obj = geomalloc_cache();
+    geomalloc_count(&obj->frees[power]);
+    geomalloc_live(obj, -(Zint)power2W(power));
+    if(!geomalloc_is_small(power) && buddy_owns(rend)) {
+        buddy_free(rend, power);
+        return;
+    }
+    if(!geomalloc_is_small(power)) {
+        pthread_mutex_lock(&galloc_shared.lock);
+        *(Nint*)rend = galloc_shared.available[power];
+        galloc_shared.available[power] = rend;
+        pthread_mutex_unlock(&galloc_shared.lock);
+        return;
+    }
+    Wint seg_mask = power2W(PIV_GEOMALLOC_SEGMENT_POWER) - 1;
+    struct piv_geometric_alloc_obj* owner =
+        ((struct piv_geometric_segment*)(rend & ~seg_mask))->owner;
+    if(owner == obj)
+        geomalloc_push(owner, rend, power);
+    else
+        geomalloc_remote_push(owner, rend, power);
 }
 
 void left_geofree(Nint lend, Wchar power) {
-    Wint bytes = 1 << power;
-    Nint rend = lend - bytes;
-    printf("  left_geofree() %ld bytes at %ld\n", bytes, lend);
-    free((void*) rend);
+    Wint bytes = power2W(power);
+    geofree(lend - bytes, power);
 }
 
 Wchar log2floor(Wint arg) {
@@ -88,5 +342,5 @@ Wint power2W(Wchar n) {
         return 0;   // This if should not be necessary
                     // but it protects against compilers doing
                     // a modulo rotate.
-    return (Wint)(1 << n);
+    return (Wint)1 << n;
 }
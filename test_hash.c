@@ -0,0 +1,79 @@
+// rvec_hash() kernel test: hashes every length from 0 to 4000 bytes at
+// three alignments with the AVX2, SSE2 and scalar lanes kernels, each
+// in a child process restricted by noarch_cpu_mask(), and checks that
+// they all agree.
+//
+// gcc -O2 -fno-builtin -pthread -Iinclude test_hash.c src/*.c -lm
+
+#include "pivlib.h"
+#include "array.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define MAX_LENGTH 4000
+#define OFFSETS 3
+#define KERNELS 3
+
+static const int kernel_masks[KERNELS] = {
+    -1, NOARCH_CPU_SSE2, 0
+};
+static const char* kernel_names[KERNELS] = {"avx2", "sse2", "scalar"};
+
+static Wchar buffer[MAX_LENGTH + OFFSETS];
+
+static void hash_all(uint64_t* hashes) {
+    for(int len = 0; len <= MAX_LENGTH; len++)
+        for(int s = 0; s < OFFSETS; s++) {
+            struct rvec v = {(Nint)(buffer + s), (Nint)(buffer + s + len)};
+            hashes[len * OFFSETS + s] = rvec_hash(v, s * 77);
+        }
+}
+
+int main() {
+    uint32_t x = 1;
+    for(int i = 0; i < MAX_LENGTH + OFFSETS; i++)
+        buffer[i] = (x = x * 1103515245 + 12345) >> 16;
+
+    // Children hash into shared memory, each with a fresh dispatch
+    Wint count = (MAX_LENGTH + 1) * OFFSETS;
+    uint64_t* hashes = mmap(0, KERNELS * count * sizeof(uint64_t),
+                            PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(hashes == MAP_FAILED) {
+        printf("mmap() failed\n");
+        exit(EXIT_FAILURE);
+    }
+    for(int k = 0; k < KERNELS; k++) {
+        pid_t child = fork();
+        if(child == 0) {
+            noarch_cpu_mask(kernel_masks[k]);
+            hash_all(hashes + k * count);
+            _exit(0);
+        }
+        int status;
+        if(child < 0 || waitpid(child, &status, 0) != child
+           || !WIFEXITED(status) || WEXITSTATUS(status)) {
+            printf("%s kernel run failed\n", kernel_names[k]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if(!(noarch_cpu_features() & NOARCH_CPU_AVX2))
+        printf("no AVX2 on this CPU, avx2 run used %s\n",
+               (noarch_cpu_features() & NOARCH_CPU_SSE2) ? "sse2" : "scalar");
+    for(int k = 1; k < KERNELS; k++)
+        for(Wint i = 0; i < count; i++)
+            if(hashes[i] != hashes[k * count + i]) {
+                printf("length %lu offset %lu: %s %016lx, %s %016lx\n",
+                       i / OFFSETS, i % OFFSETS,
+                       kernel_names[0], (unsigned long)hashes[i],
+                       kernel_names[k], (unsigned long)hashes[k * count + i]);
+                exit(EXIT_FAILURE);
+            }
+    printf("hash test passed: %d kernels, lengths 0 to %d\n",
+           KERNELS, MAX_LENGTH);
+    return 0;
+}
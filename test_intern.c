@@ -0,0 +1,93 @@
+// Intern pool stress test: 4 threads intern the same 100000 strings in
+// different orders while the pool grows, then every id and character is
+// checked against the strings and against the other threads.
+//
+// gcc -O2 -fno-builtin -pthread -Iinclude test_intern.c src/*.c -lm
+
+#include "pivlib.h"
+#include "piv_string.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define THREADS 4
+#define STRINGS 100000
+
+static char names[STRINGS][400];
+static ustr interned[THREADS][STRINGS];
+static struct ustr_pool* pool;
+
+// 1 if the ustr holds exactly the C string
+static int same_chars(const ustr* s, const char* c) {
+    rvec v = ustr_get_rvec(s);
+    Nint p = v.rvec.zero;
+    while(p != v.rvec.nth && *c)
+        if(*(Wchar*)--p != (Wchar)*c++)
+            return 0;
+    return p - 1 == v.rvec.nth && *(Wchar*)v.rvec.nth == 0 && !*c;
+}
+
+static void* intern_all(void* arg) {
+    long t = (long)arg;
+    for(long k = 0; k < 2 * STRINGS; k++) {
+        long i = (t * STRINGS / THREADS + k * 7919) % STRINGS;
+        ustr u;
+        if(k & 1)
+            u = c2ustr_intern(pool, names[i]);
+        else {
+            ustr tmp = c2ustr(names[i]);
+            u = ustr_intern(pool, &tmp);
+            ustr_free(tmp);
+        }
+        if(interned[t][i].str
+           && USTR_INTERN_ID(interned[t][i]) != USTR_INTERN_ID(u)) {
+            printf("thread %ld: string %ld changed id\n", t, i);
+            exit(EXIT_FAILURE);
+        }
+        interned[t][i] = u;
+    }
+    return 0;
+}
+
+int main() {
+    // Short, medium and heap length strings, unique by their number
+    for(int i = 0; i < STRINGS; i++) {
+        int length = (i % 7 == 0) ? 300 + i % 90 : i % 20;
+        int k = sprintf(names[i], "%d", i);
+        for(; k < length; k++)
+            names[i][k] = 'a' + (i * k) % 26;
+        names[i][k] = 0;
+    }
+
+    pool = ustr_pool_new();
+    pthread_t threads[THREADS];
+    for(long t = 0; t < THREADS; t++)
+        pthread_create(&threads[t], 0, intern_all, (void*)t);
+    for(int t = 0; t < THREADS; t++)
+        pthread_join(threads[t], 0);
+
+    for(int i = 0; i < STRINGS; i++) {
+        for(int t = 0; t < THREADS; t++) {
+            if(USTR_INTERN_ID(interned[t][i]) != USTR_INTERN_ID(interned[0][i])
+               || !same_chars(&interned[t][i], names[i])) {
+                printf("string %d: bad intern in thread %d\n", i, t);
+                exit(EXIT_FAILURE);
+            }
+        }
+        ustr plain = c2ustr(names[i]);
+        if(!ustr_eq(&interned[0][i], &plain)
+           || ustr_cmp(&interned[0][i], &plain)) {
+            printf("string %d: interned and plain ustrs differ\n", i);
+            exit(EXIT_FAILURE);
+        }
+        ustr_free(plain);
+    }
+    if(ustr_pool_count(pool) != STRINGS) {
+        printf("pool holds %lu strings, expected %d\n",
+               ustr_pool_count(pool), STRINGS);
+        exit(EXIT_FAILURE);
+    }
+    ustr_pool_free(pool);
+    printf("intern test passed: %d threads, %d strings\n", THREADS, STRINGS);
+    return 0;
+}